@@ -0,0 +1,42 @@
+// Compiled to assembly by CheckCodegen.cmake, never linked.
+// Each strata_* function must compile to the same instructions as its direct_* twin.
+#include <strata.h>
+
+using namespace strata;
+
+// Defined elsewhere so the calls cannot be folded away
+int  add(int a, int b);
+void store(int value);
+
+struct AddOp : LayerOp<int, int, int> {};
+struct StoreOp : LayerOp<void, int> {};
+
+// Observable hooks, so any leftover layer code would show up in the assembly
+struct DisabledLayer
+{
+    static inline volatile int touched = 0;
+
+    template <typename Op>
+    struct Impl
+    {
+        template <typename... Args>
+        static void Before(Args&&...) { touched = 1; }
+
+        template <typename... Args>
+        static void After(Args&&...) { touched = 2; }
+    };
+};
+
+template <>
+struct strata::LayerTraits<DisabledLayer>
+{
+    static constexpr bool compiletimeEnabled = false;
+};
+
+using Bypass = util::LayerFilter<DisabledLayer>;
+
+extern "C" int direct_add(int a, int b) { return add(a, b); }
+extern "C" int strata_add(int a, int b) { return Bypass::Exec<AddOp>(add, a, b); }
+
+extern "C" void direct_store(int value) { store(value); }
+extern "C" void strata_store(int value) { Bypass::Exec<StoreOp>(store, value); }
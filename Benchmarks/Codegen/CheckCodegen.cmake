@@ -0,0 +1,90 @@
+# Verifies that a Strata stack with every layer disabled compiles to the bare call.
+#
+# Usage:
+#   cmake -DCOMPILER=<cxx> -DCOMPILER_ID=<GNU|Clang|AppleClang|MSVC> -DSOURCE=<BypassCodegen.cpp>
+#         -DINCLUDE_DIR=<include> -DOUTPUT_DIR=<dir> -P CheckCodegen.cmake
+
+set(FUNCTION_PAIRS "direct_add:strata_add" "direct_store:strata_store")
+
+file(MAKE_DIRECTORY "${OUTPUT_DIR}")
+
+if(COMPILER_ID STREQUAL "MSVC")
+    set(ASM_FILE "${OUTPUT_DIR}/BypassCodegen.asm")
+    execute_process(
+        COMMAND "${COMPILER}" /nologo /std:c++17 /O2 /EHsc /c "/FA" "/Fa${ASM_FILE}" "/Fo${OUTPUT_DIR}/BypassCodegen.obj"
+                "/I${INCLUDE_DIR}" "${SOURCE}"
+        RESULT_VARIABLE COMPILE_RESULT
+        OUTPUT_VARIABLE COMPILE_OUTPUT
+        ERROR_VARIABLE COMPILE_OUTPUT)
+else()
+    set(ASM_FILE "${OUTPUT_DIR}/BypassCodegen.s")
+    execute_process(
+        COMMAND "${COMPILER}" -std=c++17 -O2 -S -fno-asynchronous-unwind-tables
+                "-I${INCLUDE_DIR}" "${SOURCE}" -o "${ASM_FILE}"
+        RESULT_VARIABLE COMPILE_RESULT
+        OUTPUT_VARIABLE COMPILE_OUTPUT
+        ERROR_VARIABLE COMPILE_OUTPUT)
+endif()
+
+if(NOT COMPILE_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to compile ${SOURCE}:\n${COMPILE_OUTPUT}")
+endif()
+
+# MSVC listings use ';' for comments, which would otherwise split the list
+file(READ "${ASM_FILE}" ASM_TEXT)
+string(REPLACE ";" "#" ASM_TEXT "${ASM_TEXT}")
+string(REPLACE "\n" ";" ASM_LINES "${ASM_TEXT}")
+
+# Collects the normalized instructions of one function into <out_var>
+function(extract_function name out_var)
+    set(inside FALSE)
+    set(body "")
+    foreach(line IN LISTS ASM_LINES)
+        if(NOT inside)
+            if(line MATCHES "^_?${name}:" OR line MATCHES "^${name}[ \t]+PROC")
+                set(inside TRUE)
+            endif()
+            continue()
+        endif()
+
+        if(line MATCHES "^[ \t]*\\.size[ \t]+_?${name}" OR line MATCHES "^${name}[ \t]+ENDP"
+           OR line MATCHES "^[ \t]*\\.cfi_endproc" OR line MATCHES "^_?[A-Za-z_][A-Za-z0-9_]*:")
+            break()
+        endif()
+
+        string(REGEX REPLACE "#.*$" "" line "${line}")
+        string(REGEX REPLACE "[ \t]+" " " line "${line}")
+        string(STRIP "${line}" line)
+
+        # Keep instructions only: drop directives, local labels and MSVC bookkeeping
+        if(line STREQUAL "" OR line MATCHES "^\\." OR line MATCHES ":$" OR line MATCHES "^\\$LN")
+            continue()
+        endif()
+        list(APPEND body "${line}")
+    endforeach()
+
+    if(NOT inside)
+        message(FATAL_ERROR "Function '${name}' not found in ${ASM_FILE}")
+    endif()
+    set(${out_var} "${body}" PARENT_SCOPE)
+endfunction()
+
+foreach(pair IN LISTS FUNCTION_PAIRS)
+    string(REPLACE ":" ";" pair "${pair}")
+    list(GET pair 0 direct_name)
+    list(GET pair 1 strata_name)
+
+    extract_function(${direct_name} direct_body)
+    extract_function(${strata_name} strata_body)
+
+    if(NOT direct_body STREQUAL strata_body)
+        string(REPLACE ";" "\n    " direct_text "${direct_body}")
+        string(REPLACE ";" "\n    " strata_text "${strata_body}")
+        message(FATAL_ERROR "${strata_name} does not compile to the bare call\n"
+                            "  ${direct_name}:\n    ${direct_text}\n"
+                            "  ${strata_name}:\n    ${strata_text}")
+    endif()
+
+    string(REPLACE ";" " | " direct_text "${direct_body}")
+    message(STATUS "${strata_name} matches ${direct_name}: ${direct_text}")
+endforeach()
@@ -0,0 +1,89 @@
+# Records compile time and object size of SyntheticStack.cpp for several stack shapes.
+#
+# Usage:
+#   cmake -DCOMPILER=<cxx> -DCOMPILER_ID=<GNU|Clang|AppleClang|MSVC> -DSOURCE=<SyntheticStack.cpp>
+#         -DINCLUDE_DIR=<include> -DOUTPUT_DIR=<dir> [-DSTANDARD=17] [-DCONFIGS=<layers>x<ops>;...]
+#         [-DBASELINE=<csv>] [-DTOLERANCE=<percent>] -P CompileTime.cmake
+#
+# Results are written to <OUTPUT_DIR>/compile_time.csv. Passing a previous csv as BASELINE
+# fails the run when a configuration's time or size grows by more than TOLERANCE percent.
+
+if(NOT DEFINED STANDARD)
+    set(STANDARD 17)
+endif()
+if(NOT DEFINED CONFIGS)
+    set(CONFIGS "1x1" "8x8" "16x32" "40x100")
+endif()
+if(NOT DEFINED TOLERANCE)
+    set(TOLERANCE 25)
+endif()
+
+file(MAKE_DIRECTORY "${OUTPUT_DIR}")
+set(CSV "layers,ops,milliseconds,bytes\n")
+
+foreach(config IN LISTS CONFIGS)
+    string(REPLACE "x" ";" shape "${config}")
+    list(GET shape 0 layers)
+    list(GET shape 1 ops)
+
+    if(COMPILER_ID STREQUAL "MSVC")
+        set(OBJECT "${OUTPUT_DIR}/SyntheticStack_${config}.obj")
+        set(COMMAND "${COMPILER}" /nologo /std:c++${STANDARD} /O2 /EHsc /bigobj /c "/Fo${OBJECT}" "/I${INCLUDE_DIR}"
+                    /DSTRATA_BENCH_LAYERS=${layers} /DSTRATA_BENCH_OPS=${ops} "${SOURCE}")
+    else()
+        set(OBJECT "${OUTPUT_DIR}/SyntheticStack_${config}.o")
+        set(COMMAND "${COMPILER}" -std=c++${STANDARD} -O2 -c "-I${INCLUDE_DIR}"
+                    -DSTRATA_BENCH_LAYERS=${layers} -DSTRATA_BENCH_OPS=${ops} "${SOURCE}" -o "${OBJECT}")
+    endif()
+
+    string(TIMESTAMP start "%s%f")
+    execute_process(COMMAND ${COMMAND}
+        RESULT_VARIABLE COMPILE_RESULT
+        OUTPUT_VARIABLE COMPILE_OUTPUT
+        ERROR_VARIABLE COMPILE_OUTPUT)
+    string(TIMESTAMP end "%s%f")
+
+    if(NOT COMPILE_RESULT EQUAL 0)
+        message(FATAL_ERROR "Failed to compile ${config}:\n${COMPILE_OUTPUT}")
+    endif()
+
+    # Timestamps are in microseconds
+    math(EXPR milliseconds "(${end} - ${start}) / 1000")
+    file(SIZE "${OBJECT}" bytes)
+    string(APPEND CSV "${layers},${ops},${milliseconds},${bytes}\n")
+    message(STATUS "${layers} layers x ${ops} ops: ${milliseconds} ms, ${bytes} bytes")
+
+    set(RESULT_${config}_ms ${milliseconds})
+    set(RESULT_${config}_bytes ${bytes})
+endforeach()
+
+file(WRITE "${OUTPUT_DIR}/compile_time.csv" "${CSV}")
+
+if(DEFINED BASELINE)
+    file(STRINGS "${BASELINE}" baseline_lines)
+    set(failures "")
+    foreach(line IN LISTS baseline_lines)
+        if(NOT line MATCHES "^([0-9]+),([0-9]+),([0-9]+),([0-9]+)$")
+            continue()
+        endif()
+        set(config "${CMAKE_MATCH_1}x${CMAKE_MATCH_2}")
+        if(NOT DEFINED RESULT_${config}_ms)
+            continue()
+        endif()
+
+        math(EXPR time_limit "${CMAKE_MATCH_3} * (100 + ${TOLERANCE}) / 100")
+        math(EXPR size_limit "${CMAKE_MATCH_4} * (100 + ${TOLERANCE}) / 100")
+        if(RESULT_${config}_ms GREATER time_limit)
+            list(APPEND failures "${config}: ${RESULT_${config}_ms} ms, baseline ${CMAKE_MATCH_3} ms")
+        endif()
+        if(RESULT_${config}_bytes GREATER size_limit)
+            list(APPEND failures "${config}: ${RESULT_${config}_bytes} bytes, baseline ${CMAKE_MATCH_4} bytes")
+        endif()
+    endforeach()
+
+    if(failures)
+        string(REPLACE ";" "\n  " failure_text "${failures}")
+        message(FATAL_ERROR "Compile cost exceeds the baseline by more than ${TOLERANCE}%:\n  ${failure_text}")
+    endif()
+    message(STATUS "Within ${TOLERANCE}% of ${BASELINE}")
+endif()
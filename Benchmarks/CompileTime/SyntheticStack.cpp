@@ -0,0 +1,72 @@
+// Compiled by CompileTime.cmake with -DSTRATA_BENCH_LAYERS=<N> -DSTRATA_BENCH_OPS=<M>, never linked.
+// Builds a LayerPack of N layers and executes M operations through its LayerFilter, so the
+// compile time and object size track the cost of instantiating Strata for large stacks.
+#include <strata.h>
+#include <utility>
+
+#ifndef STRATA_BENCH_LAYERS
+    #define STRATA_BENCH_LAYERS 8
+#endif
+#ifndef STRATA_BENCH_OPS
+    #define STRATA_BENCH_OPS 8
+#endif
+
+using namespace strata;
+
+// Defined elsewhere so the calls cannot be folded away
+int add(int a, int b);
+
+template <int N>
+struct SyntheticOp : LayerOp<int, int, int>
+{
+    static constexpr int kIndex = N;
+};
+
+static volatile int sink = 0;
+
+// Implements two out of three operations, alternating between token and plain hooks
+template <int L>
+struct SyntheticLayer
+{
+    template <typename Op, typename = void>
+    struct Impl
+    {};
+
+    template <typename Op>
+    struct Impl<Op, std::enable_if_t<(Op::kIndex + L) % 3 != 0 && L % 2 == 0>>
+    {
+        static int Before(int a, int b) { return a + L; }
+        static void After(int token, int& result, int, int) { sink = token + result; }
+    };
+
+    template <typename Op>
+    struct Impl<Op, std::enable_if_t<(Op::kIndex + L) % 3 != 0 && L % 2 != 0>>
+    {
+        static void Before(int a, int) { sink = a; }
+        static void After(int& result, int, int) { sink = result; }
+    };
+};
+
+// Every fourth layer is compiled out
+template <int L>
+struct strata::LayerTraits<SyntheticLayer<L>>
+{
+    static constexpr bool compiletimeEnabled = L % 4 != 3;
+};
+
+template <int... L>
+util::LayerPack<SyntheticLayer<L>...> MakePack(std::integer_sequence<int, L...>);
+
+using SyntheticPack  = decltype(MakePack(std::make_integer_sequence<int, STRATA_BENCH_LAYERS> {}));
+using SyntheticStack = util::LayerFilter<SyntheticPack>;
+
+template <int... M>
+int RunAll(int a, int b, std::integer_sequence<int, M...>)
+{
+    return (0 + ... + SyntheticStack::Exec<SyntheticOp<M>>(add, a, b));
+}
+
+int run(int a, int b)
+{
+    return RunAll(a, b, std::make_integer_sequence<int, STRATA_BENCH_OPS> {});
+}
@@ -1,9 +1,18 @@
 #include <benchmark/benchmark.h>
 #include <strata.h>
+#include <array>
+#include <string>
+#include <vector>
 
 using namespace strata;
 
-__declspec(noinline) int add(int a, int b) {
+#if defined(_MSC_VER)
+    #define BENCH_NOINLINE __declspec(noinline)
+#else
+    #define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+BENCH_NOINLINE int add(int a, int b) {
     return a + b;
 }
 struct AddOp : LayerOp<int, int, int> {};
@@ -30,6 +39,7 @@ struct HeavyLayer {
     };
 };
 template<> struct LayerTraits<HeavyLayer> { static constexpr bool compiletimeEnabled = true; };
+template<> struct LayerConcurrencyTraits<HeavyLayer> { static constexpr bool threadSafe = true; };
 
 static void BM_Direct(benchmark::State& state) {
     int a = 42, b = 24;
@@ -56,3 +66,299 @@ static void BM_LayerEnabled(benchmark::State& state) {
     }
 }
 BENCHMARK(BM_LayerEnabled);
+
+
+////////////////////////////////////////
+// Layer count and hook shape
+////////////////////////////////////////
+
+// Layer without any Impl, only participates in detection
+template<int N>
+struct EmptyLayer {};
+
+// Layer with the cheapest possible hooks
+template<int N>
+struct TrivialLayer {
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&... args) { benchmark::ClobberMemory(); }
+
+        template<typename... Args>
+        static void After(Args&&... args) { benchmark::ClobberMemory(); }
+    };
+};
+
+template<typename Seq, template<int> class Layer>
+struct RepeatedLayers;
+
+template<int... N, template<int> class Layer>
+struct RepeatedLayers<std::integer_sequence<int, N...>, Layer> {
+    using type = Strata<Layer<N>...>;
+};
+
+template<int Count, template<int> class Layer = TrivialLayer>
+using RepeatedStrata = typename RepeatedLayers<std::make_integer_sequence<int, Count>, Layer>::type;
+
+static void BM_EmptyLayers(benchmark::State& state) {
+    int a = 42, b = 24;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(RepeatedStrata<4, EmptyLayer>::Exec<AddOp>(add, a, b));
+    }
+}
+BENCHMARK(BM_EmptyLayers);
+
+template<int Count>
+static void BM_TrivialLayers(benchmark::State& state) {
+    int a = 42, b = 24;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(RepeatedStrata<Count>::template Exec<AddOp>(add, a, b));
+    }
+}
+BENCHMARK_TEMPLATE(BM_TrivialLayers, 1);
+BENCHMARK_TEMPLATE(BM_TrivialLayers, 4);
+BENCHMARK_TEMPLATE(BM_TrivialLayers, 16);
+
+static int sink = 0;
+BENCH_NOINLINE void store(int value) {
+    sink = value;
+}
+struct StoreOp : LayerOp<void, int> {};
+
+static void BM_VoidOpDirect(benchmark::State& state) {
+    int value = 42;
+    for (auto _ : state) {
+        store(value);
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_VoidOpDirect);
+
+static void BM_VoidOpLayered(benchmark::State& state) {
+    int value = 42;
+    for (auto _ : state) {
+        RepeatedStrata<4>::Exec<StoreOp>(store, value);
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_VoidOpLayered);
+
+static void BM_ValueOpLayered(benchmark::State& state) {
+    int a = 42, b = 24;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(RepeatedStrata<4>::Exec<AddOp>(add, a, b));
+    }
+}
+BENCHMARK(BM_ValueOpLayered);
+
+struct DeferredHeavyLayer : HeavyLayer {};
+template<> struct LayerTraits<DeferredHeavyLayer> { static constexpr bool compiletimeEnabled = true; };
+template<> struct LayerConcurrencyTraits<DeferredHeavyLayer> { static constexpr bool deferAfter = true; };
+
+// Caller-side cost once After is moved to the drain thread
+static void BM_DeferredAfter(benchmark::State& state) {
+    int a = 42, b = 24;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Strata<DeferredHeavyLayer>::Exec<AddOp>(add, a, b));
+    }
+    DeferredAfterQueue::Flush();
+}
+BENCHMARK(BM_DeferredAfter)->UseRealTime();
+
+// A hit skips HeavyLayer and the core entirely
+static void BM_MemoizedHit(benchmark::State& state) {
+    int a = 42, b = 24;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Strata<util::Memoize<>, HeavyLayer>::Exec<AddOp>(add, a, b));
+    }
+}
+BENCHMARK(BM_MemoizedHit);
+
+// Recording both events into the thread's ring, the cost of tracing every call
+static void BM_ChromeTrace(benchmark::State& state) {
+    int a = 42, b = 24;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Strata<util::ChromeTrace>::Exec<AddOp>(add, a, b));
+    }
+    util::ChromeTrace::Clear();
+}
+BENCHMARK(BM_ChromeTrace);
+
+static void BM_ExecLoop(benchmark::State& state) {
+    std::vector<AddOp::BatchArguments> inputs(static_cast<std::size_t>(state.range(0)), { 42, 24 });
+    std::vector<int> results(inputs.size());
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < inputs.size(); ++i)
+            results[i] = RepeatedStrata<4>::Exec<AddOp>(add, std::get<0>(inputs[i]), std::get<1>(inputs[i]));
+        benchmark::DoNotOptimize(results.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ExecLoop)->Arg(1024);
+
+static void BM_ExecBatch(benchmark::State& state) {
+    std::vector<AddOp::BatchArguments> inputs(static_cast<std::size_t>(state.range(0)), { 42, 24 });
+    std::vector<int> results(inputs.size());
+    for (auto _ : state) {
+        RepeatedStrata<4>::ExecBatch<AddOp>(add, inputs, results);
+        benchmark::DoNotOptimize(results.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ExecBatch)->Arg(1024);
+
+static void BM_ExecBatchParallel(benchmark::State& state) {
+    std::vector<AddOp::BatchArguments> inputs(static_cast<std::size_t>(state.range(0)), { 42, 24 });
+    std::vector<int> results(inputs.size());
+    auto& pool = util::WorkStealingPool::Default();
+    for (auto _ : state) {
+        Strata<HeavyLayer>::ExecBatch<AddOp>(pool, add, inputs, results);
+        benchmark::DoNotOptimize(results.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ExecBatchParallel)->Arg(1 << 14)->UseRealTime();
+
+
+////////////////////////////////////////
+// Large arguments
+////////////////////////////////////////
+
+using LargeBuffer = std::array<char, 4096>;
+
+BENCH_NOINLINE std::size_t checksumRef(const LargeBuffer& buffer) {
+    return static_cast<std::size_t>(buffer[0]) + buffer[buffer.size() - 1];
+}
+BENCH_NOINLINE std::size_t checksumValue(LargeBuffer buffer) {
+    return static_cast<std::size_t>(buffer[0]) + buffer[buffer.size() - 1];
+}
+BENCH_NOINLINE std::size_t totalLength(std::vector<std::string> payload) {
+    std::size_t total = 0;
+    for (const auto& item : payload)
+        total += item.size();
+    return total;
+}
+
+struct ChecksumRefOp : LayerOp<std::size_t, const LargeBuffer&> {};
+struct ChecksumValueOp : LayerOp<std::size_t, LargeBuffer> {};
+struct TotalLengthOp : LayerOp<std::size_t, std::vector<std::string>> {};
+
+static void BM_LargeArgByRef(benchmark::State& state) {
+    LargeBuffer buffer{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(RepeatedStrata<4>::Exec<ChecksumRefOp>(checksumRef, buffer));
+    }
+}
+BENCHMARK(BM_LargeArgByRef);
+
+static void BM_LargeArgByValue(benchmark::State& state) {
+    LargeBuffer buffer{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(RepeatedStrata<4>::Exec<ChecksumValueOp>(checksumValue, buffer));
+    }
+}
+BENCHMARK(BM_LargeArgByValue);
+
+static void BM_LargeArgMovedPayload(benchmark::State& state) {
+    const std::vector<std::string> payload(64, std::string(64, 'x'));
+    for (auto _ : state) {
+        auto copy = payload;
+        benchmark::DoNotOptimize(RepeatedStrata<4>::Exec<TotalLengthOp>(totalLength, std::move(copy)));
+    }
+}
+BENCHMARK(BM_LargeArgMovedPayload);
+
+
+////////////////////////////////////////
+// State access in hooks
+////////////////////////////////////////
+
+struct BenchCounter {
+    int calls = 0;
+
+    BenchCounter& operator+=(const BenchCounter& other) {
+        calls += other.calls;
+        return *this;
+    }
+};
+struct BenchAtomicCounter {
+    int calls = 0;
+};
+template<> struct strata::LayerStateTraits<BenchAtomicCounter> {
+    using Sync = sync::Atomic<&BenchAtomicCounter::calls>;
+};
+
+struct GlobalStateLayer {
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) { LayerStateManager<BenchCounter>::global()->calls++; }
+    };
+};
+
+struct HandleStateLayer {
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) {
+            static thread_local auto state = LayerStateManager<BenchCounter>::handle();
+            state->calls++;
+        }
+    };
+};
+
+struct ShardedStateLayer {
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) {
+            static thread_local auto state = LayerStateManager<BenchCounter>::sharded();
+            state->calls++;
+        }
+    };
+};
+
+struct AtomicStateLayer {
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) {
+            static thread_local auto state = LayerStateManager<BenchAtomicCounter>::handle();
+            state.fetch_add<&BenchAtomicCounter::calls>(1);
+        }
+    };
+};
+
+template<typename StateLayer>
+static void BM_StateAccess(benchmark::State& state) {
+    int a = 42, b = 24;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Strata<StateLayer>::template Exec<AddOp>(add, a, b));
+    }
+}
+// threads:1 is the uncontended cost, higher counts show LayerState contention
+BENCHMARK_TEMPLATE(BM_StateAccess, GlobalStateLayer)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_StateAccess, HandleStateLayer)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_StateAccess, ShardedStateLayer)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_StateAccess, AtomicStateLayer)->ThreadRange(1, 16)->UseRealTime();
+
+static void BM_StateRead(benchmark::State& state) {
+    auto counter = LayerStateManager<BenchCounter>::handle("read");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(counter.read());
+    }
+}
+BENCHMARK(BM_StateRead)->ThreadRange(1, 16)->UseRealTime();
+
+// Observer count 0 takes the no-observer fast path
+static void BM_StateModifyObserved(benchmark::State& state) {
+    LayerState<BenchCounter> counter;
+    int seen = 0;
+    for (int64_t i = 0; i < state.range(0); ++i)
+        counter.addObserver([&seen](const BenchCounter& value) { seen += value.calls; });
+    for (auto _ : state) {
+        counter.modify([](BenchCounter& value) { value.calls++; });
+    }
+    benchmark::DoNotOptimize(seen);
+}
+BENCHMARK(BM_StateModifyObserved)->Arg(0)->Arg(1)->Arg(4);
@@ -2,6 +2,9 @@
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <cstring>
+#include <map>
+#include <set>
 #include <strata.h>
 
 using namespace strata;
@@ -734,3 +737,795 @@ TEST(LayerStateTests, ContextIteration)
         EXPECT_EQ(value, contexts.size());
     }
 }
+
+struct ShardedCounterState {
+    int hits = 0;
+    long long bytes = 0;
+
+    ShardedCounterState& operator+=(const ShardedCounterState& other) {
+        hits += other.hits;
+        bytes += other.bytes;
+        return *this;
+    }
+};
+
+TEST(LayerStateTests, ShardedConcurrentUpdates)
+{
+    LayerStateRegistry::Clear();
+
+    const int NUM_THREADS = 8;
+    const int NUM_ITERATIONS = 10000;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back([NUM_ITERATIONS]() {
+            auto state = LayerStateManager<ShardedCounterState>::sharded();
+            for (int j = 0; j < NUM_ITERATIONS; ++j) {
+                state->hits++;
+                state->bytes += 2;
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto state = LayerStateManager<ShardedCounterState>::sharded();
+    auto merged = state.read();
+    EXPECT_EQ(merged.hits, NUM_THREADS * NUM_ITERATIONS);
+    EXPECT_EQ(merged.bytes, 2LL * NUM_THREADS * NUM_ITERATIONS);
+
+    // Sharded and regular state of the same type are independent
+    EXPECT_EQ(LayerStateManager<ShardedCounterState>::global().read().hits, 0);
+}
+
+TEST(LayerStateTests, ShardedBeyondInlineShards)
+{
+    LayerStateRegistry::Clear();
+
+    // More live threads than inline shards, all running at once
+    const int NUM_THREADS = 2 * ShardedLayerState<ShardedCounterState>::kShardCount + 8;
+    const int NUM_ITERATIONS = 1000;
+
+    std::mutex indexMutex;
+    std::set<std::size_t> indices;
+    std::atomic<int> arrived { 0 };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back([&, NUM_ITERATIONS]() {
+            {
+                std::lock_guard<std::mutex> lock(indexMutex);
+                indices.insert(detail::ThisThreadIndex());
+            }
+            arrived++;
+            while (arrived < NUM_THREADS)
+                std::this_thread::yield();
+
+            auto state = LayerStateManager<ShardedCounterState>::sharded("crowded");
+            for (int j = 0; j < NUM_ITERATIONS; ++j)
+                state->hits++;
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Live threads never share an index, so each one had a shard of its own
+    EXPECT_EQ(indices.size(), static_cast<std::size_t>(NUM_THREADS));
+    EXPECT_EQ(LayerStateManager<ShardedCounterState>::sharded("crowded").read().hits, NUM_THREADS * NUM_ITERATIONS);
+
+    // Exited threads hand their index to the next one
+    std::size_t reused = 0;
+    std::thread([&reused] { reused = detail::ThisThreadIndex(); }).join();
+    EXPECT_EQ(indices.count(reused), 1u);
+}
+
+TEST(LayerStateTests, ShardedAggregateAndReset)
+{
+    LayerStateRegistry::Clear();
+
+    auto state = LayerStateManager<ShardedCounterState>::sharded("aggregated");
+    state->hits += 5;
+
+    std::thread([] {
+        LayerStateManager<ShardedCounterState>::sharded("aggregated")->hits += 7;
+    }).join();
+
+    EXPECT_EQ(state.aggregate().hits, 12);
+
+    // Folded values persist in the base after shards are cleared
+    state->hits += 1;
+    EXPECT_EQ(state.read().hits, 13);
+    EXPECT_EQ(state.aggregate().hits, 13);
+
+    state.reset();
+    EXPECT_EQ(state.read().hits, 0);
+}
+
+TEST(LayerStateTests, ShardedAggregateDuringUpdates)
+{
+    LayerStateRegistry::Clear();
+
+    const int NUM_THREADS = 4;
+    const int NUM_ITERATIONS = 20000;
+
+    std::atomic<bool> done { false };
+    std::thread aggregator([&done] {
+        auto state = LayerStateManager<ShardedCounterState>::sharded("busy");
+        int last = 0;
+        while (!done) {
+            // Totals only grow while owners fold their shards lazily
+            int total = state.aggregate().hits;
+            EXPECT_GE(total, last);
+            last = total;
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back([NUM_ITERATIONS]() {
+            auto state = LayerStateManager<ShardedCounterState>::sharded("busy");
+            for (int j = 0; j < NUM_ITERATIONS; ++j)
+                state->hits++;
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done = true;
+    aggregator.join();
+
+    auto state = LayerStateManager<ShardedCounterState>::sharded("busy");
+    EXPECT_EQ(state.read().hits, NUM_THREADS * NUM_ITERATIONS);
+    EXPECT_EQ(state.aggregate().hits, NUM_THREADS * NUM_ITERATIONS);
+}
+
+TEST(LayerStateTests, ContextInterning)
+{
+    auto idA = LayerStateRegistry::InternContext("InternedA");
+    auto idB = LayerStateRegistry::InternContext("InternedB");
+
+    EXPECT_NE(idA, idB);
+    EXPECT_EQ(idA, LayerStateRegistry::InternContext("InternedA"));
+    EXPECT_EQ(LayerStateRegistry::InternContext("global"), kGlobalContext);
+    EXPECT_EQ(LayerStateRegistry::GetContextName(idB), "InternedB");
+
+    // Ids and string names resolve to the same state
+    LayerStateRegistry::Clear();
+    LayerStateManager<TestState>::forContext(idA)->counter = 7;
+    EXPECT_EQ(LayerStateManager<TestState>::forContext("InternedA").read().counter, 7);
+}
+
+TEST(LayerStateTests, HandleCachesUntilInvalidated)
+{
+    LayerStateRegistry::Clear();
+
+    auto handle = LayerStateManager<TestState>::handle("cached");
+    handle->counter = 5;
+
+    const LayerState<TestState>* resolved = &handle.get();
+    EXPECT_EQ(&handle.get(), resolved);
+    EXPECT_EQ(LayerStateManager<TestState>::forContext("cached").read().counter, 5);
+
+    // Removing the state invalidates the cached pointer
+    LayerStateManager<TestState>::removeState("cached");
+    EXPECT_EQ(handle.read().counter, 0);
+
+    handle->counter = 9;
+    LayerStateRegistry::Clear();
+    EXPECT_EQ(handle.read().counter, 0);
+    EXPECT_EQ(LayerStateManager<TestState>::global().read().counter, 0);
+}
+
+struct SharedConfigState {
+    int version = 0;
+    std::string name;
+};
+
+struct SeqLockPairState {
+    long long first = 0;
+    long long second = 0;
+};
+
+template<> struct strata::LayerStateTraits<SharedConfigState> { using Sync = sync::SharedReaders; };
+template<> struct strata::LayerStateTraits<SeqLockPairState> { using Sync = sync::SeqLock; };
+
+TEST(LayerStateTests, SharedReadersPolicy)
+{
+    LayerStateRegistry::Clear();
+
+    auto state = LayerStateManager<SharedConfigState>::global();
+    state.write(SharedConfigState{1, "v1"});
+
+    std::atomic<int> readErrors{0};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&state, &readErrors] {
+            for (int j = 0; j < 1000; ++j) {
+                auto config = state.read();
+                if (config.name != "v" + std::to_string(config.version))
+                    readErrors++;
+            }
+        });
+    }
+
+    for (int i = 2; i < 100; ++i) {
+        state.modify([i](SharedConfigState& s) {
+            s.version = i;
+            s.name = "v" + std::to_string(i);
+        });
+    }
+
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(readErrors, 0);
+    EXPECT_EQ(state.read().version, 99);
+}
+
+TEST(LayerStateTests, SeqLockPolicy)
+{
+    LayerStateRegistry::Clear();
+
+    auto state = LayerStateManager<SeqLockPairState>::global();
+    std::atomic<bool> done{false};
+    std::atomic<int> tornReads{0};
+
+    std::thread reader([&state, &done, &tornReads] {
+        while (!done) {
+            auto pair = state.read();
+            if (pair.first != pair.second)
+                tornReads++;
+        }
+    });
+
+    std::vector<int> observed;
+    state.addObserver([&observed](const SeqLockPairState& s) { observed.push_back(static_cast<int>(s.first)); });
+
+    for (int i = 1; i <= 10000; ++i) {
+        state.modify([i](SeqLockPairState& s) {
+            s.first = i;
+            s.second = i;
+        });
+    }
+    state.write(SeqLockPairState{20000, 20000});
+
+    done = true;
+    reader.join();
+
+    EXPECT_EQ(tornReads, 0);
+    EXPECT_EQ(state.read().first, 20000);
+    EXPECT_EQ(observed.size(), 10001);
+}
+
+struct DeferredMetricsState {
+    int value = 0;
+};
+
+template<> struct strata::LayerStateTraits<DeferredMetricsState> { using Notify = notify::Deferred; };
+
+TEST(LayerStateTests, DeferredObserversCoalesce)
+{
+    LayerStateRegistry::Clear();
+    ObserverDispatcher::SetInterval(std::chrono::milliseconds(50));
+
+    auto state = LayerStateManager<DeferredMetricsState>::global();
+
+    std::atomic<int> notifications{0};
+    std::atomic<int> lastSeen{-1};
+    state.addObserver([&](const DeferredMetricsState& s) {
+        notifications++;
+        lastSeen = s.value;
+    });
+
+    for (int i = 1; i <= 10000; ++i) {
+        state.modify([i](DeferredMetricsState& s) { s.value = i; });
+    }
+
+    ObserverDispatcher::Flush();
+
+    EXPECT_GE(notifications, 1);
+    EXPECT_LT(notifications, 100);
+    EXPECT_EQ(lastSeen, 10000);
+}
+
+TEST(LayerStateTests, DeferredObserversDoNotBlockWriters)
+{
+    LayerStateRegistry::Clear();
+    ObserverDispatcher::SetInterval(std::chrono::milliseconds(1));
+
+    auto state = LayerStateManager<DeferredMetricsState>::forContext("slow");
+    std::atomic<int> notifications{0};
+    state.addObserver([&notifications](const DeferredMetricsState&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        notifications++;
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; ++i) {
+        state->value++;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_LT(elapsed, std::chrono::milliseconds(100));
+    EXPECT_EQ(state.read().value, 100);
+
+    // Dropping the state with a notification queued must be safe
+    state->value++;
+    LayerStateRegistry::Clear();
+    state = LayerStateManager<DeferredMetricsState>::forContext("slow");
+    ObserverDispatcher::Flush();
+    EXPECT_EQ(state.read().value, 0);
+}
+
+struct AtomicCounterState {
+    int calls = 0;
+    std::uint64_t bytes = 0;
+};
+
+template<> struct strata::LayerStateTraits<AtomicCounterState> {
+    using Sync = sync::Atomic<&AtomicCounterState::calls, &AtomicCounterState::bytes>;
+};
+
+struct AtomicCountingLayer {
+    template<typename Op>
+    struct Impl {
+        static void Before(int value) {
+            static thread_local auto state = LayerStateManager<AtomicCounterState>::handle();
+            state.fetch_add<&AtomicCounterState::calls>(1);
+            state.fetch_add<&AtomicCounterState::bytes>(static_cast<std::uint64_t>(value));
+        }
+    };
+};
+
+TEST(LayerStateTests, AtomicFieldState)
+{
+    LayerStateRegistry::Clear();
+
+    struct CountOp : LayerOp<void, int> {};
+    using TestLayers = Strata<AtomicCountingLayer>;
+
+    const int NUM_THREADS = 4;
+    const int NUM_ITERATIONS = 10000;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back([NUM_ITERATIONS]() {
+            for (int j = 0; j < NUM_ITERATIONS; ++j) {
+                TestLayers::Exec<CountOp>([](int) {}, 3);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto state = LayerStateManager<AtomicCounterState>::global();
+    EXPECT_EQ(state.load<&AtomicCounterState::calls>(), NUM_THREADS * NUM_ITERATIONS);
+
+    auto totals = state.read();
+    EXPECT_EQ(totals.calls, NUM_THREADS * NUM_ITERATIONS);
+    EXPECT_EQ(totals.bytes, 3u * NUM_THREADS * NUM_ITERATIONS);
+
+    state.write(AtomicCounterState{1, 2});
+    EXPECT_EQ(state.read().bytes, 2u);
+}
+
+TEST(LayerStateTests, ScopedContext)
+{
+    LayerStateRegistry::Clear();
+    const ContextId tenant = LayerStateRegistry::InternContext("tenant");
+    LayerStateManager<TestState>::setCurrentContext(kGlobalContext);
+
+    {
+        ScopedContext scope(tenant);
+        EXPECT_EQ(LayerStateManager<TestState>::getCurrentContext(), "tenant");
+        LayerStateManager<TestState>::current()->counter = 3;
+
+        {
+            ScopedContext nested("nested");
+            LayerStateManager<TestState>::current()->counter = 7;
+        }
+        EXPECT_EQ(LayerStateRegistry::getCurrentContextId(), tenant);
+        EXPECT_EQ(LayerStateManager<TestState>::current().read().counter, 3);
+    }
+
+    EXPECT_EQ(LayerStateRegistry::getCurrentContextId(), kGlobalContext);
+    EXPECT_EQ(LayerStateManager<TestState>::forContext("tenant").read().counter, 3);
+    EXPECT_EQ(LayerStateManager<TestState>::forContext("nested").read().counter, 7);
+    EXPECT_EQ(LayerStateManager<TestState>::current().read().counter, 0);
+
+    // Cached lookups follow Clear()
+    LayerStateRegistry::Clear();
+    ScopedContext scope(tenant);
+    EXPECT_EQ(LayerStateManager<TestState>::current().read().counter, 0);
+}
+
+TEST(LayerStateTests, WrappersOutliveClear)
+{
+    LayerStateRegistry::Clear();
+    EXPECT_NE(detail::StateTypeId<LayerState<TestState>>::value, detail::StateTypeId<ShardedLayerState<TestState>>::value);
+
+    auto held = LayerStateManager<TestState>::forContext("arena");
+    held->counter = 5;
+
+    // The wrapper keeps its generation alive, new lookups start from a fresh one
+    LayerStateRegistry::Clear();
+    EXPECT_EQ(held.read().counter, 5);
+    EXPECT_EQ(LayerStateManager<TestState>::forContext("arena").read().counter, 0);
+
+    auto handle = LayerStateManager<TestState>::handle("arena");
+    handle->counter = 9;
+    EXPECT_EQ(&handle.get(), &handle.get());
+    EXPECT_EQ(LayerStateManager<TestState>::forContext("arena").read().counter, 9);
+
+    // So do wrappers from the thread's cached accessors, even after the cache moved on
+    auto cached = LayerStateManager<TestState>::global();
+    LayerStateRegistry::Clear();
+    auto fresh = LayerStateManager<TestState>::global();
+    cached->counter = 2;
+    EXPECT_EQ(cached.read().counter, 2);
+    EXPECT_EQ(fresh.read().counter, 0);
+}
+
+struct ReleaseTrackedState {
+    static inline std::atomic<int> destroyed { 0 };
+    int value = 0;
+    ~ReleaseTrackedState() { destroyed++; }
+};
+
+TEST(LayerStateTests, ClearReleasesUnheldStates)
+{
+    LayerStateRegistry::Clear();
+    ReleaseTrackedState::destroyed = 0;
+
+    auto held = LayerStateManager<ReleaseTrackedState>::forContext("held");
+    held->value = 3;
+    LayerStateManager<ReleaseTrackedState>::forContext("dropped")->value = 4;
+
+    // Only the state a wrapper still points at survives, not everything created with it
+    LayerStateRegistry::Clear();
+    EXPECT_EQ(ReleaseTrackedState::destroyed, 1);
+    EXPECT_EQ(held->value, 3);
+
+    held = LayerStateManager<ReleaseTrackedState>::forContext("held");
+    EXPECT_EQ(ReleaseTrackedState::destroyed, 2);
+}
+
+struct PooledState {
+    int value = 0;
+};
+
+TEST(LayerStateTests, PooledStatesReuseChunks)
+{
+    LayerStateRegistry::Clear();
+    const LayerState<PooledState>* first = nullptr;
+    {
+        auto handle = LayerStateManager<PooledState>::handle("pooled_a");
+        handle->value = 1;
+        first = &handle.get();
+    }
+
+    // A removed state hands its chunk back to the type's pool, the next state takes it
+    LayerStateManager<PooledState>::removeState("pooled_a");
+    auto next = LayerStateManager<PooledState>::handle("pooled_b");
+    EXPECT_EQ(&next.get(), first);
+    EXPECT_EQ(next.read().value, 0);
+}
+
+TEST(LayerStateTests, SnapshotIteration)
+{
+    LayerStateRegistry::Clear();
+    LayerStateManager<TestState>::forContext("scrape_a")->counter = 1;
+    LayerStateManager<TestState>::forContext("scrape_b")->counter = 2;
+
+    // The registry is unlocked while the callback runs, so it may create states
+    int visited = 0;
+    LayerStateManager<TestState>::iterateStates([&](const std::string& context, const LayerState<TestState>& state) {
+        ++visited;
+        LayerStateManager<TestState>::forContext(context + "_seen")->counter = state.read().counter;
+    });
+    EXPECT_EQ(visited, 2);
+    EXPECT_EQ(LayerStateManager<TestState>::forContext("scrape_b_seen").read().counter, 2);
+
+    // States visited by the snapshot stay valid even if the registry is cleared mid-scrape
+    int total = 0;
+    LayerStateManager<TestState>::iterateStates([&](const std::string&, const LayerState<TestState>& state) {
+        LayerStateRegistry::Clear();
+        total += state.read().counter;
+    });
+    EXPECT_EQ(total, 6);
+}
+
+struct ExportedCounters {
+    std::uint32_t hits = 0;
+    std::uint32_t errors = 0;
+    double latency = 0.0;
+};
+
+TEST(LayerStateTests, BinaryExport)
+{
+    LayerStateRegistry::Clear();
+    LayerStateManager<ExportedCounters>::forContext("svc_a")->hits = 3;
+    LayerStateManager<ExportedCounters>::forContext("svc_b")->latency = 1.5;
+
+    auto buffer = LayerStateManager<ExportedCounters>::exportStates();
+
+    StateExportHeader header;
+    ASSERT_GE(buffer.size(), sizeof(header));
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    EXPECT_EQ(header.magic, StateExportHeader::kMagic);
+    EXPECT_EQ(header.stateSize, sizeof(ExportedCounters));
+    ASSERT_EQ(header.count, 2u);
+
+    EXPECT_EQ(header.version, StateExportHeader::kVersion);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(buffer.data() + sizeof(header)), header.typeNameSize), "ExportedCounters");
+
+    std::map<std::string, ExportedCounters> decoded;
+    std::size_t offset = sizeof(header) + header.typeNameSize;
+    for (std::uint32_t i = 0; i < header.count; ++i) {
+        std::uint32_t contextSize = 0;
+        std::memcpy(&contextSize, buffer.data() + offset, sizeof(contextSize));
+        offset += sizeof(contextSize);
+        std::string context(reinterpret_cast<const char*>(buffer.data() + offset), contextSize);
+        offset += contextSize;
+        std::memcpy(&decoded[context], buffer.data() + offset, sizeof(ExportedCounters));
+        offset += sizeof(ExportedCounters);
+    }
+    EXPECT_EQ(offset, buffer.size());
+    EXPECT_EQ(decoded["svc_a"].hits, 3u);
+    EXPECT_EQ(decoded["svc_b"].latency, 1.5);
+
+    // Streaming produces the same bytes, and ExportAll includes this section
+    std::vector<std::byte> streamed;
+    LayerStateManager<ExportedCounters>::exportStates([&](const void* data, std::size_t size) {
+        auto bytes = static_cast<const std::byte*>(data);
+        streamed.insert(streamed.end(), bytes, bytes + size);
+    });
+    EXPECT_EQ(streamed, buffer);
+    EXPECT_GE(LayerStateRegistry::ExportAll().size(), buffer.size());
+}
+
+struct WarmCounters {
+    std::uint64_t requests = 0;
+    std::uint32_t trips = 0;
+};
+template<> struct strata::LayerStateTraits<WarmCounters> {
+    using Storage = storage::Mapped;
+};
+
+TEST(LayerStateTests, MappedPersistence)
+{
+    const std::string path = "strata_mapped_state.bin";
+    std::remove(path.c_str());
+
+    LayerStateRegistry::AttachMappedFile(std::make_shared<MappedStateFile>(path, 1 << 16));
+    LayerStateRegistry::Clear();
+    LayerStateManager<WarmCounters>::forContext("breaker")->trips = 3;
+    LayerStateManager<WarmCounters>::global()->requests = 1000;
+    LayerStateManager<TestState>::global()->counter = 11;
+
+    // Simulated restart: drop every in-process state and reopen the file
+    LayerStateRegistry::AttachMappedFile(nullptr);
+    LayerStateRegistry::Clear();
+    LayerStateRegistry::AttachMappedFile(std::make_shared<MappedStateFile>(path, 1 << 16));
+
+    EXPECT_EQ(LayerStateManager<WarmCounters>::forContext("breaker").read().trips, 3u);
+    EXPECT_EQ(LayerStateManager<WarmCounters>::global().read().requests, 1000u);
+    EXPECT_EQ(LayerStateManager<TestState>::global().read().counter, 0);
+
+    // Within one process a cleared state still starts fresh
+    LayerStateRegistry::Clear();
+    EXPECT_EQ(LayerStateManager<WarmCounters>::forContext("breaker").read().trips, 0u);
+
+    LayerStateRegistry::AttachMappedFile(nullptr);
+    LayerStateRegistry::Clear();
+    std::remove(path.c_str());
+}
+
+struct HostCounters {
+    std::uint64_t requests = 0;
+};
+template<> struct strata::LayerStateTraits<HostCounters> {
+    using Storage = storage::Shared;
+};
+
+TEST(LayerStateTests, SharedSegment)
+{
+    const std::string name = "strata_shared_state_test";
+    SharedStateSegment::Remove(name);
+
+    // Two mappings of one segment stand in for two worker processes
+    LayerStateRegistry::AttachSharedSegment(std::make_shared<SharedStateSegment>(name, 1 << 16));
+    LayerStateRegistry::Clear();
+    auto first = LayerStateManager<HostCounters>::global();
+
+    LayerStateRegistry::AttachSharedSegment(std::make_shared<SharedStateSegment>(name, 1 << 16));
+    LayerStateRegistry::Clear();
+    auto second = LayerStateManager<HostCounters>::global();
+
+    constexpr int kIncrements = 10000;
+    std::thread worker([&] {
+        for (int i = 0; i < kIncrements; ++i)
+            first.modify([](HostCounters& counters) { counters.requests++; });
+    });
+    for (int i = 0; i < kIncrements; ++i)
+        second.modify([](HostCounters& counters) { counters.requests++; });
+    worker.join();
+
+    EXPECT_EQ(first.read().requests, 2u * kIncrements);
+    EXPECT_EQ(second.read().requests, 2u * kIncrements);
+
+    LayerStateRegistry::AttachSharedSegment(nullptr);
+    LayerStateRegistry::Clear();
+    SharedStateSegment::Remove(name);
+}
+
+struct TenantState {
+    int requests = 0;
+};
+template<> struct strata::LayerStateTraits<TenantState> {
+    using Lifetime = lifetime::Evictable;
+};
+
+TEST(LayerStateTests, Eviction)
+{
+    LayerStateRegistry::Clear();
+
+    std::map<std::string, int> flushed;
+    StateEvictionPolicy<TenantState> policy;
+    policy.maxStates = 2;
+    policy.onEvict   = [&](const std::string& context, const TenantState& state) { flushed[context] = state.requests; };
+    LayerStateManager<TenantState>::setEvictionPolicy(policy);
+
+    auto hot = LayerStateManager<TenantState>::handle("hot");
+    hot->requests = 1;
+    auto cold = LayerStateManager<TenantState>::forContext("cold");
+    cold->requests = 2;
+
+    // Both states were referenced, so the sweep gives each a second chance and then takes the oldest
+    LayerStateManager<TenantState>::forContext("new")->requests = 3;
+    ASSERT_EQ(flushed.size(), 1u);
+    EXPECT_EQ(flushed["hot"], 1);
+
+    // The handle notices and starts over, which pushes out the now unreferenced "cold"
+    EXPECT_EQ(hot.read().requests, 0);
+    EXPECT_EQ(flushed["cold"], 2);
+
+    int visited = 0;
+    LayerStateManager<TenantState>::iterateStates([&](const std::string&, const LayerState<TenantState>&) { ++visited; });
+    EXPECT_EQ(visited, 2);
+
+    // A wrapper held across eviction still owns its state
+    EXPECT_EQ(cold.read().requests, 2);
+
+    // Idle states expire
+    flushed.clear();
+    policy.maxStates = 0;
+    policy.ttl       = std::chrono::milliseconds(1);
+    LayerStateManager<TenantState>::setEvictionPolicy(policy);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    LayerStateManager<TenantState>::evictExpired();
+    EXPECT_EQ(flushed.size(), 2u);
+
+    LayerStateRegistry::Clear();
+}
+
+struct SessionState {
+    static inline std::atomic<int> live { 0 };
+    int requests = 0;
+    SessionState() { live++; }
+    SessionState(const SessionState& other) : requests(other.requests) { live++; }
+    ~SessionState() { live--; }
+};
+template<> struct strata::LayerStateTraits<SessionState> {
+    using Lifetime = lifetime::Evictable;
+};
+
+TEST(LayerStateTests, CurrentReleasesEvictedStates)
+{
+    LayerStateRegistry::Clear();
+    StateEvictionPolicy<SessionState> policy;
+    policy.maxStates = 4;
+    LayerStateManager<SessionState>::setEvictionPolicy(policy);
+
+    for (int i = 0; i < 256; ++i) {
+        ScopedContext scope("session" + std::to_string(i));
+        LayerStateManager<SessionState>::current()->requests++;
+    }
+
+    // Later lookups sweep the per-thread table, so evicted states are not kept by idle entries
+    ScopedContext scope(kGlobalContext);
+    for (int i = 0; i < 4096; ++i)
+        LayerStateManager<SessionState>::current()->requests++;
+    EXPECT_LE(SessionState::live, 4);
+
+    LayerStateRegistry::Clear();
+}
+
+TEST(LayerStateTests, ContextRecycling)
+{
+    LayerStateRegistry::Clear();
+    StateEvictionPolicy<SessionState> policy;
+    policy.maxStates = 1;
+    LayerStateManager<SessionState>::setEvictionPolicy(policy);
+
+    // Each eviction frees the previous request's context, so two ids take turns
+    std::set<std::uint32_t> ids;
+    for (int i = 0; i < 1000; ++i) {
+        ScopedContext scope("request" + std::to_string(i));
+        ids.insert(LayerStateRegistry::getCurrentContextId().value);
+        EXPECT_EQ(LayerStateManager<SessionState>::current().read().requests, 0);
+        LayerStateManager<SessionState>::current()->requests++;
+    }
+    EXPECT_LE(ids.size(), 2u);
+
+    // A removed state releases its context, the recycled id starts from a fresh state
+    ContextId dropped;
+    {
+        ScopedContext scope("dropped");
+        dropped = LayerStateRegistry::getCurrentContextId();
+        LayerStateManager<TestState>::current()->counter = 5;
+    }
+    LayerStateManager<TestState>::removeState("dropped");
+    {
+        ScopedContext scope("reused");
+        EXPECT_EQ(LayerStateRegistry::getCurrentContextId(), dropped);
+        EXPECT_EQ(LayerStateRegistry::getCurrentContext(), "reused");
+        EXPECT_EQ(LayerStateManager<TestState>::current().read().counter, 0);
+    }
+
+    // Interned names are kept
+    auto kept = LayerStateRegistry::InternContext("kept");
+    LayerStateManager<TestState>::forContext(kept)->counter = 1;
+    LayerStateManager<TestState>::removeState("kept");
+    EXPECT_EQ(LayerStateRegistry::InternContext("kept"), kept);
+
+    LayerStateRegistry::Clear();
+}
+
+TEST(LayerStateTests, ObserverSubscription)
+{
+    LayerState<TestState> state;
+    std::vector<int> first, second;
+
+    auto subscription = state.addObserver([&first](const TestState& s) { first.push_back(s.counter); });
+    std::function<void(const TestState&)> wrapped = [&second](const TestState& s) { second.push_back(s.counter); };
+    state.addObserver(wrapped);
+
+    state.modify([](TestState& s) { s.counter = 1; });
+    subscription.unsubscribe();
+    subscription.unsubscribe();
+    state.modify([](TestState& s) { s.counter = 2; });
+
+    EXPECT_EQ(first, std::vector<int>({ 1 }));
+    EXPECT_EQ(second, std::vector<int>({ 1, 2 }));
+
+    // The freed slot is reused and the stale handle cannot remove its new occupant
+    auto replacement = state.addObserver([&first](const TestState& s) { first.push_back(-s.counter); });
+    subscription.unsubscribe();
+    state.modify([](TestState& s) { s.counter = 3; });
+    EXPECT_EQ(first, std::vector<int>({ 1, -3 }));
+
+    // Observers may unsubscribe themselves while being notified
+    ObserverSubscription once;
+    int onceCalls = 0;
+    once = state.addObserver([&](const TestState&) { ++onceCalls; once.unsubscribe(); });
+    state.modify([](TestState& s) { s.counter = 4; });
+    state.modify([](TestState& s) { s.counter = 5; });
+    EXPECT_EQ(onceCalls, 1);
+
+    // Unsubscribing after the state is gone is a no-op
+    ObserverSubscription orphan;
+    {
+        LayerState<TestState> scoped;
+        orphan = scoped.addObserver([](const TestState&) {});
+    }
+    orphan.unsubscribe();
+}
@@ -1,8 +1,12 @@
 #include <gtest/gtest.h>
 #include <strata.h>
+#include <chrono>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 using namespace strata;
@@ -253,3 +257,770 @@ TEST_F(LayerUsageTests, StateIteration)
     EXPECT_TRUE(std::find(levels.begin(), levels.end(), LoggingLayer::Data::kLogLevelError) != levels.end());
     EXPECT_TRUE(std::find(levels.begin(), levels.end(), LoggingLayer::Data::kLogLevelNone) != levels.end());
 }
+
+struct TracingLayer
+{
+    struct Data
+    {
+        int beforeCount = 0;
+        int afterCount = 0;
+    };
+
+    template<typename Op>
+    struct Impl {
+        static void Before(int, int) {
+            LayerStateManager<TracingLayer::Data>::global()->beforeCount++;
+        }
+        static void After(int&, int, int) {
+            LayerStateManager<TracingLayer::Data>::global()->afterCount++;
+        }
+    };
+};
+
+template<> struct LayerTraits<TracingLayer> { static constexpr bool compiletimeEnabled = true; };
+
+TEST_F(LayerUsageTests, SampledLayer)
+{
+    using SampledTracing = util::Sampled<TracingLayer, 10>;
+    using Stratum = util::LayerFilter<SampledTracing, ValidationLayer>;
+    static_assert(std::is_same_v<Stratum, Strata<SampledTracing, ValidationLayer>>);
+
+    auto state = LayerStateManager<TracingLayer::Data>::global();
+    const int calls = 10000;
+
+    for (int i = 0; i < calls; ++i)
+        EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::Add, i, 1), i + 1);
+
+    auto sampled = state.read();
+    EXPECT_EQ(sampled.beforeCount, sampled.afterCount);
+    EXPECT_GT(sampled.beforeCount, calls / 20);
+    EXPECT_LT(sampled.beforeCount, calls / 5);
+
+    // Unsampled calls still run the other layers
+    EXPECT_THROW(Stratum::Exec<LayerOpAdd>(layertest::Add, -1, 1), std::invalid_argument);
+
+    // Runtime rate control
+    SampledTracing::SetRate(1);
+    state.write({});
+    for (int i = 0; i < 100; ++i)
+        Stratum::Exec<LayerOpAdd>(layertest::Add, i, 1);
+    EXPECT_EQ(state.read().beforeCount, 100);
+
+    SampledTracing::SetRate(0);
+    state.write({});
+    for (int i = 0; i < 100; ++i)
+        Stratum::Exec<LayerOpAdd>(layertest::Add, i, 1);
+    EXPECT_EQ(state.read().afterCount, 0);
+
+    SampledTracing::SetRate(10);
+}
+
+struct DiagnosticsLayer
+{
+    struct Data
+    {
+        int calls = 0;
+    };
+
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) {
+            LayerStateManager<DiagnosticsLayer::Data>::global()->calls++;
+        }
+    };
+};
+
+template<> struct LayerTraits<DiagnosticsLayer> {
+    static constexpr bool compiletimeEnabled = true;
+    static constexpr bool runtimeEnabled = false;
+};
+
+TEST_F(LayerUsageTests, RuntimeToggle)
+{
+    using Stratum = util::LayerFilter<DiagnosticsLayer, MetricsLayer>;
+    auto diagnostics = LayerStateManager<DiagnosticsLayer::Data>::global();
+    auto metrics = LayerStateManager<MetricsLayer::Data>::global();
+
+    // Declared initial state applies until toggled
+    EXPECT_FALSE(util::IsRuntimeEnabled<DiagnosticsLayer>());
+    Stratum::Exec<LayerOpAdd>(layertest::Add, 1, 2);
+    EXPECT_EQ(diagnostics.read().calls, 0);
+    EXPECT_EQ(metrics.read().operationCount, 1);
+
+    util::SetRuntimeEnabled<DiagnosticsLayer>(true);
+    EXPECT_TRUE(util::IsRuntimeEnabled<DiagnosticsLayer>());
+    Stratum::Exec<LayerOpAdd>(layertest::Add, 1, 2);
+    Stratum::Exec<LayerOpPrint>(layertest::Print, "Diagnostics on");
+    EXPECT_EQ(diagnostics.read().calls, 2);
+
+    util::SetRuntimeEnabled<DiagnosticsLayer>(false);
+    Stratum::Exec<LayerOpAdd>(layertest::Add, 1, 2);
+    EXPECT_EQ(diagnostics.read().calls, 2);
+    EXPECT_EQ(metrics.read().operationCount, 4);
+}
+
+TEST_F(LayerUsageTests, LatencyHistogram)
+{
+    struct LayerOpSleep : LayerOp<int, int> {};
+    using Stratum = Strata<MetricsLayer, util::LatencyHistogram>;
+    util::LatencyHistogram::Reset<LayerOpSleep>();
+
+    auto sleepFor = [](int millis) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+        return millis;
+    };
+
+    for (int i = 0; i < 5; ++i)
+        EXPECT_EQ(Stratum::Exec<LayerOpSleep>(sleepFor, 2), 2);
+
+    std::thread([&] { Stratum::Exec<LayerOpSleep>(sleepFor, 20); }).join();
+
+    auto latency = util::LatencyHistogram::Snapshot<LayerOpSleep>();
+    EXPECT_EQ(latency.count, 6);
+    EXPECT_GE(latency.min, 2'000'000u);
+    EXPECT_GE(latency.max, 20'000'000u);
+    EXPECT_GE(latency.percentile(50), 2'000'000u);
+    EXPECT_LT(latency.percentile(50), 20'000'000u);
+    EXPECT_EQ(latency.percentile(100), latency.max);
+
+    // Other operations have their own histogram
+    EXPECT_EQ(util::LatencyHistogram::Snapshot<LayerOpAdd>().count, 0);
+}
+
+// Count heap allocations for util::AllocationCounter across the test binary
+STRATA_COUNT_ALLOCATIONS()
+
+struct ScratchLayer
+{
+    inline static const void* lastBuffer = nullptr;
+
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) {
+            EXPECT_TRUE(ScratchArena<Op>::InScope());
+            std::pmr::vector<int> values({ 1, 2, 3 }, ScratchArena<Op>::Resource());
+            lastBuffer = values.data();
+        }
+    };
+};
+
+template<> struct LayerTraits<ScratchLayer> {
+    static constexpr bool compiletimeEnabled = true;
+    static constexpr bool usesScratch = true;
+};
+
+TEST_F(LayerUsageTests, ScratchArena)
+{
+    using Stratum = Strata<ScratchLayer, MetricsLayer>;
+
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::Add, 1, 2), 3);
+    const void* first = ScratchLayer::lastBuffer;
+    EXPECT_FALSE(ScratchArena<LayerOpAdd>::InScope());
+
+    // The arena is released after each call, so the next one reuses the same memory
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::Add, 2, 3), 5);
+    EXPECT_EQ(ScratchLayer::lastBuffer, first);
+
+    // Nested calls of the same operation share the outer call's arena
+    const void* nested = nullptr;
+    auto reentrant = [&](int a, int b) {
+        int result = Stratum::Exec<LayerOpAdd>(layertest::Add, a, b);
+        nested = ScratchLayer::lastBuffer;
+        return result;
+    };
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(reentrant, 3, 4), 7);
+    EXPECT_NE(nested, first);
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::Add, 1, 1), 2);
+    EXPECT_EQ(ScratchLayer::lastBuffer, first);
+
+    // Batches release the arena after every element, not only once the batch ends
+    std::vector<LayerOpAdd::BatchArguments> inputs = { { 1, 2 }, { 3, 4 }, { 5, 6 } };
+    std::vector<int> results(inputs.size());
+    Stratum::ExecBatch<LayerOpAdd>(layertest::Add, inputs, results);
+    EXPECT_EQ(results, (std::vector<int> { 3, 7, 11 }));
+    EXPECT_EQ(ScratchLayer::lastBuffer, first);
+    EXPECT_FALSE(ScratchArena<LayerOpAdd>::InScope());
+}
+
+TEST_F(LayerUsageTests, AllocationCounter)
+{
+    struct LayerOpFill : LayerOp<std::size_t, int> {};
+    using Stratum = Strata<util::AllocationCounter>;
+    util::AllocationCounter::Reset<LayerOpFill>();
+    util::AllocationCounter::Reset<LayerOpAdd>();
+
+    auto fill = [](int count) {
+        std::vector<int> values(static_cast<std::size_t>(count), 7);
+        return values.size();
+    };
+
+    EXPECT_EQ(Stratum::Exec<LayerOpFill>(fill, 16), 16u);
+    EXPECT_EQ(Stratum::Exec<LayerOpFill>(fill, 0), 0u);
+    std::thread([&] { Stratum::Exec<LayerOpFill>(fill, 32); }).join();
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::Add, 1, 2), 3);
+
+    auto fills = util::AllocationCounter::Snapshot<LayerOpFill>();
+    EXPECT_EQ(fills.calls, 3u);
+    EXPECT_EQ(fills.allocations, 2u);
+    EXPECT_EQ(fills.bytes, 48 * sizeof(int));
+    EXPECT_DOUBLE_EQ(fills.allocationsPerCall(), 2.0 / 3.0);
+
+    auto adds = util::AllocationCounter::Snapshot<LayerOpAdd>();
+    EXPECT_EQ(adds.calls, 1u);
+    EXPECT_EQ(adds.allocations, 0u);
+}
+
+struct HookTraceLayer
+{
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) {}
+    };
+};
+
+struct UntracedLayer
+{
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) {}
+    };
+};
+
+template<> struct LayerTraits<HookTraceLayer> { static constexpr bool compiletimeEnabled = true; };
+template<> struct LayerTraits<UntracedLayer> {
+    static constexpr bool compiletimeEnabled = true;
+    static constexpr bool traceHooks = false;
+};
+
+TEST_F(LayerUsageTests, ChromeTrace)
+{
+    using Stratum = Strata<util::ChromeTrace, HookTraceLayer, UntracedLayer>;
+    auto count = [](const std::string& text, const std::string& pattern) {
+        std::size_t found = 0;
+        for (auto at = text.find(pattern); at != std::string::npos; at = text.find(pattern, at + 1))
+            found++;
+        return found;
+    };
+
+    util::ChromeTrace::Clear();
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::Add, 1, 2), 3);
+    std::thread([] { Stratum::Exec<LayerOpAdd>(layertest::Add, 3, 4); }).join();
+
+    util::ChromeTrace::SetCapturing(false);
+    Stratum::Exec<LayerOpAdd>(layertest::Add, 5, 6);
+    util::ChromeTrace::SetCapturing(true);
+
+    // Each call spans its layers' hooks, HookTraceLayer has no After so only Before is traced
+    std::string trace = util::ChromeTrace::Export();
+    EXPECT_EQ(trace.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0u);
+    EXPECT_EQ(count(trace, "\"ph\":\"B\""), 4u);
+    EXPECT_EQ(count(trace, "\"ph\":\"E\""), 4u);
+    EXPECT_EQ(count(trace, "{\"name\":\"LayerOpAdd\",\"cat\":\"Exec\""), 4u);
+    EXPECT_EQ(count(trace, "{\"name\":\"HookTraceLayer\",\"cat\":\"LayerOpAdd\""), 4u);
+    EXPECT_EQ(count(trace, "\"args\":{\"hook\":\"Before\"}"), 4u);
+    EXPECT_EQ(count(trace, "UntracedLayer"), 0u);
+
+    // Once the ring wraps, an end event that lost its begin is left out
+    util::ChromeTrace::Clear();
+    EXPECT_EQ(count(util::ChromeTrace::Export(), "\"ph\""), 0u);
+
+    constexpr std::size_t kCalls = util::ChromeTrace::kRingCapacity / 2;
+    std::thread([] {
+        using Calls = Strata<util::ChromeTrace>;
+        for (std::size_t i = 0; i < kCalls; ++i)
+            Calls::Exec<LayerOpAdd>(layertest::Add, 1, 2);
+
+        // A throwing core leaves its span open
+        auto fail = [](int, int) -> int { throw std::runtime_error("failed"); };
+        EXPECT_THROW(Calls::Exec<LayerOpAdd>(fail, 1, 2), std::runtime_error);
+    }).join();
+
+    trace = util::ChromeTrace::Export();
+    EXPECT_EQ(count(trace, "\"ph\":\"B\""), kCalls);
+    EXPECT_EQ(count(trace, "\"ph\":\"E\""), kCalls - 1);
+    util::ChromeTrace::Clear();
+}
+
+namespace layertest
+{
+    struct Payload
+    {
+        inline static int copies = 0;
+        std::vector<int> items;
+
+        explicit Payload(std::vector<int> values) : items(std::move(values)) {}
+        Payload(const Payload& other) : items(other.items) { copies++; }
+        Payload(Payload&&) noexcept = default;
+    };
+
+    std::size_t Consume(Payload payload) { return payload.items.size(); }
+}
+
+struct LayerOpConsume : LayerOp<std::size_t, layertest::Payload> {};
+
+struct PayloadLayer
+{
+    struct Data
+    {
+        std::size_t sizeBefore = 0;
+        std::size_t sizeAfter = 0;
+    };
+
+    template<typename Op>
+    struct Impl {
+        static void Before(const layertest::Payload& payload) {
+            LayerStateManager<PayloadLayer::Data>::global()->sizeBefore = payload.items.size();
+        }
+        static void After(std::size_t&, const layertest::Payload& payload) {
+            LayerStateManager<PayloadLayer::Data>::global()->sizeAfter = payload.items.size();
+        }
+    };
+};
+
+template<> struct LayerTraits<PayloadLayer> { static constexpr bool compiletimeEnabled = true; };
+
+TEST_F(LayerUsageTests, ArgumentForwarding)
+{
+    using Stratum = Strata<PayloadLayer, MetricsLayer>;
+    layertest::Payload::copies = 0;
+
+    layertest::Payload payload({ 1, 2, 3 });
+    EXPECT_EQ(Stratum::Exec<LayerOpConsume>(layertest::Consume, std::move(payload)), 3u);
+
+    // Hooks saw the payload intact, only the core moved from it
+    auto state = LayerStateManager<PayloadLayer::Data>::global();
+    EXPECT_EQ(state.read().sizeBefore, 3u);
+    EXPECT_EQ(state.read().sizeAfter, 0u);
+    EXPECT_EQ(layertest::Payload::copies, 0);
+}
+
+struct SpanLayer
+{
+    struct Data
+    {
+        int opened = 0;
+        std::vector<int> closed;
+    };
+
+    struct Span
+    {
+        int id;
+    };
+
+    // Before returns a token that is handed back to the matching After
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static Span Before(Args&&...) {
+            return Span{ ++LayerStateManager<SpanLayer::Data>::global()->opened };
+        }
+
+        template<typename... Args>
+        static void After(Span& span, Args&&...) {
+            LayerStateManager<SpanLayer::Data>::global()->closed.push_back(span.id);
+        }
+    };
+};
+
+template<> struct LayerTraits<SpanLayer> { static constexpr bool compiletimeEnabled = true; };
+
+TEST_F(LayerUsageTests, HookTokens)
+{
+    using Stratum = Strata<SpanLayer, MetricsLayer>;
+
+    auto nested = [](int a, int b) {
+        return Stratum::Exec<LayerOpAdd>(layertest::Add, a, b) * 2;
+    };
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(nested, 1, 2), 6);
+    Stratum::Exec<LayerOpPrint>(layertest::Print, "Spans");
+
+    // Inner spans close first, each After gets its own Before's token
+    auto state = LayerStateManager<SpanLayer::Data>::global();
+    EXPECT_EQ(state.read().closed, (std::vector<int>{ 2, 1, 3 }));
+    EXPECT_EQ(LayerStateManager<MetricsLayer::Data>::global().read().operationCount, 3);
+}
+
+struct BatchCountingLayer
+{
+    struct Data
+    {
+        int batches = 0;
+        int elements = 0;
+        int resultSum = 0;
+    };
+
+    // One state update per batch instead of per call
+    template<typename Op>
+    struct Impl {
+        static void BeforeBatch(Span<LayerOpAdd::BatchArguments> inputs) {
+            auto state = LayerStateManager<BatchCountingLayer::Data>::global();
+            state->batches++;
+            state->elements += static_cast<int>(inputs.size());
+        }
+        static void AfterBatch(Span<LayerOpAdd::BatchArguments>, Span<int> results) {
+            int sum = 0;
+            for (int result : results)
+                sum += result;
+            LayerStateManager<BatchCountingLayer::Data>::global()->resultSum += sum;
+        }
+    };
+};
+
+template<> struct LayerTraits<BatchCountingLayer> { static constexpr bool compiletimeEnabled = true; };
+
+TEST_F(LayerUsageTests, ExecBatch)
+{
+    using Stratum = Strata<BatchCountingLayer, ValidationLayer, MetricsLayer>;
+
+    std::vector<LayerOpAdd::BatchArguments> inputs = { { 1, 2 }, { 3, 4 }, { 5, 6 } };
+    std::vector<int> results(inputs.size());
+    Stratum::ExecBatch<LayerOpAdd>(layertest::Add, inputs, results);
+
+    EXPECT_EQ(results, (std::vector<int>{ 3, 7, 11 }));
+    auto batch = LayerStateManager<BatchCountingLayer::Data>::global().read();
+    EXPECT_EQ(batch.batches, 1);
+    EXPECT_EQ(batch.elements, 3);
+    EXPECT_EQ(batch.resultSum, 21);
+
+    // Layers without batch hooks run per element
+    EXPECT_EQ(LayerStateManager<MetricsLayer::Data>::global().read().operationCount, 3);
+
+    inputs.push_back({ -1, 1 });
+    results.resize(inputs.size());
+    EXPECT_THROW(Stratum::ExecBatch<LayerOpAdd>(layertest::Add, inputs, results), std::invalid_argument);
+
+    // Elements ahead of the failing one were already processed
+    EXPECT_EQ(LayerStateManager<MetricsLayer::Data>::global().read().operationCount, 6);
+
+    std::vector<int> tooFew(1);
+    EXPECT_THROW(Stratum::ExecBatch<LayerOpAdd>(layertest::Add, inputs, tooFew), std::invalid_argument);
+
+    // Per-element tokens are kept for the whole batch
+    Strata<SpanLayer>::ExecBatch<LayerOpAdd>(layertest::Add, Span(inputs.data(), 3), results);
+    EXPECT_EQ(LayerStateManager<SpanLayer::Data>::global().read().closed, (std::vector<int>{ 1, 2, 3 }));
+
+    // Void operations take no results
+    std::vector<LayerOpPrint::BatchArguments> messages = { { "Batch 1" }, { "Batch 2" } };
+    Strata<MetricsLayer>::ExecBatch<LayerOpPrint>(layertest::Print, messages);
+    EXPECT_EQ(LayerStateManager<MetricsLayer::Data>::global().read().operationCount, 8);
+}
+
+struct ConcurrentCountingLayer
+{
+    struct Data
+    {
+        int calls = 0;
+
+        Data& operator+=(const Data& other) {
+            calls += other.calls;
+            return *this;
+        }
+    };
+
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) {
+            LayerStateManager<ConcurrentCountingLayer::Data>::sharded()->calls++;
+        }
+    };
+};
+
+template<> struct LayerTraits<ConcurrentCountingLayer> { static constexpr bool compiletimeEnabled = true; };
+template<> struct LayerConcurrencyTraits<ConcurrentCountingLayer> { static constexpr bool threadSafe = true; };
+
+namespace layertest
+{
+    struct ThreadPerHalf
+    {
+        template<typename Task>
+        void ParallelFor(std::size_t count, Task&& task) {
+            std::thread upper([&] { task(count / 2, count); });
+            task(0, count / 2);
+            upper.join();
+        }
+    };
+}
+
+TEST_F(LayerUsageTests, ParallelExecBatch)
+{
+    using Stratum = Strata<BatchCountingLayer, ConcurrentCountingLayer, ValidationLayer, MetricsLayer>;
+    util::WorkStealingPool pool(3);
+
+    std::vector<LayerOpAdd::BatchArguments> inputs;
+    for (int i = 0; i < 1000; ++i)
+        inputs.push_back({ i, 1 });
+    std::vector<int> results(inputs.size());
+
+    Stratum::ExecBatch<LayerOpAdd>(pool, layertest::Add, inputs, results);
+    for (int i = 0; i < 1000; ++i)
+        EXPECT_EQ(results[i], i + 1);
+
+    EXPECT_EQ(LayerStateManager<BatchCountingLayer::Data>::global().read().batches, 1);
+    EXPECT_EQ(LayerStateManager<ConcurrentCountingLayer::Data>::sharded().read().calls, 1000);
+    EXPECT_EQ(LayerStateManager<MetricsLayer::Data>::global().read().operationCount, 1000);
+
+    // The first failing element's exception reaches the caller
+    std::get<0>(inputs[500]) = -1;
+    EXPECT_THROW(Stratum::ExecBatch<LayerOpAdd>(pool, layertest::Add, inputs, results), std::invalid_argument);
+
+    // Any type with ParallelFor(count, task) can drive the batch
+    layertest::ThreadPerHalf executor;
+    std::vector<LayerOpAdd::BatchArguments> valid(inputs.begin(), inputs.begin() + 100);
+    Strata<ConcurrentCountingLayer>::ExecBatch<LayerOpAdd>(executor, layertest::Add, valid, results);
+    EXPECT_EQ(results[99], 100);
+}
+
+struct DeferredAuditLayer
+{
+    struct Data
+    {
+        std::vector<int>             entries;
+        std::vector<std::thread::id> threads;
+    };
+
+    template<typename Op>
+    struct Impl {
+        static int Before(int a, int) { return a * 100; }
+        static void After(int token, int& result, int, int) {
+            auto state = LayerStateManager<DeferredAuditLayer::Data>::global();
+            state->entries.push_back(token + result);
+            state->threads.push_back(std::this_thread::get_id());
+            result = 0;   // only the snapshot is changed
+        }
+    };
+};
+
+template<> struct LayerTraits<DeferredAuditLayer> { static constexpr bool compiletimeEnabled = true; };
+template<> struct LayerConcurrencyTraits<DeferredAuditLayer> { static constexpr bool deferAfter = true; };
+
+TEST_F(LayerUsageTests, DeferredAfter)
+{
+    using Stratum = Strata<DeferredAuditLayer, ValidationLayer, MetricsLayer>;
+
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::Add, 2, 3), 5);
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::Add, 4, 5), 9);
+
+    // Inline After hooks of the other layers have already run
+    EXPECT_EQ(LayerStateManager<MetricsLayer::Data>::global().read().operationCount, 2);
+
+    DeferredAfterQueue::Flush();
+    auto state = LayerStateManager<DeferredAuditLayer::Data>::global().read();
+    EXPECT_EQ(state.entries, (std::vector<int>{ 205, 409 }));
+    ASSERT_EQ(state.threads.size(), 2u);
+    EXPECT_NE(state.threads[0], std::this_thread::get_id());
+
+    // Batches queue one After per element
+    std::vector<LayerOpAdd::BatchArguments> inputs = { { 1, 1 }, { 2, 2 } };
+    std::vector<int> results(inputs.size());
+    Stratum::ExecBatch<LayerOpAdd>(layertest::Add, inputs, results);
+    DeferredAfterQueue::Flush();
+    EXPECT_EQ(LayerStateManager<DeferredAuditLayer::Data>::global().read().entries, (std::vector<int>{ 205, 409, 102, 204 }));
+    EXPECT_EQ(results, (std::vector<int>{ 2, 4 }));
+}
+
+struct LayerOpLog : LayerOp<std::size_t, std::string_view> {};
+
+struct DeferredViewLayer
+{
+    struct Data
+    {
+        std::vector<std::string>     messages;
+        std::vector<std::thread::id> threads;
+    };
+
+    template<typename Op>
+    struct Impl {
+        static void After(std::size_t&, std::string_view message) {
+            auto state = LayerStateManager<DeferredViewLayer::Data>::global();
+            state->messages.emplace_back(message);
+            state->threads.push_back(std::this_thread::get_id());
+        }
+    };
+};
+
+template<> struct LayerTraits<DeferredViewLayer> { static constexpr bool compiletimeEnabled = true; };
+template<> struct LayerConcurrencyTraits<DeferredViewLayer> { static constexpr bool deferAfter = true; };
+
+TEST_F(LayerUsageTests, DeferredAfterKeepsViewsInline)
+{
+    static_assert(DeferrableArgument<std::string>::value);
+    static_assert(!DeferrableArgument<std::string_view>::value);
+    static_assert(!DeferrableArgument<const char*>::value);
+    static_assert(!DeferrableArgument<Span<int>>::value);
+    static_assert(!DeferrableArgument<std::reference_wrapper<int>>::value);
+
+    {
+        std::string message = "transient";
+        auto length = Strata<DeferredViewLayer>::Exec<LayerOpLog>([](std::string_view text) { return text.size(); }, std::string_view(message));
+        EXPECT_EQ(length, 9u);
+    }
+
+    // The view was not queued, so After already ran on this thread while it was valid
+    auto state = LayerStateManager<DeferredViewLayer::Data>::global().read();
+    EXPECT_EQ(state.messages, (std::vector<std::string>{ "transient" }));
+    ASSERT_EQ(state.threads.size(), 1u);
+    EXPECT_EQ(state.threads[0], std::this_thread::get_id());
+}
+
+namespace layertest
+{
+    int CoreCalls = 0;
+
+    int CountedAdd(int a, int b) {
+        ++CoreCalls;
+        return a + b;
+    }
+}
+
+// Skips messages starting with '#'
+struct MuteLayer
+{
+    template<typename Op>
+    struct Impl;
+
+    template<>
+    struct Impl<LayerOpPrint> {
+        static ShortCircuit<void> Before(const std::string& msg) {
+            return msg.rfind('#', 0) == 0 ? ShortCircuit<void>::Skip() : ShortCircuit<void> {};
+        }
+    };
+};
+
+TEST_F(LayerUsageTests, ShortCircuit)
+{
+    using Memo    = util::Memoize<4, 2>;
+    using Stratum = Strata<LoggingLayer, Memo, MetricsLayer>;
+    LayerStateManager<LoggingLayer::Data>::global()->logLevel = LoggingLayer::Data::kLogLevelInfo;
+    layertest::CoreCalls = 0;
+    Memo::Clear<LayerOpAdd>();
+
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::CountedAdd, 2, 3), 5);
+    EXPECT_EQ(Stratum::Exec<LayerOpAdd>(layertest::CountedAdd, 2, 3), 5);
+
+    // The hit skipped the core and the inner layer, outer layers still saw the result
+    EXPECT_EQ(layertest::CoreCalls, 1);
+    EXPECT_EQ(LayerStateManager<MetricsLayer::Data>::global().read().operationCount, 1);
+    EXPECT_EQ(layertest::Log.str(), "2 + 3 = 5\n2 + 3 = 5\n");
+
+    // Bounded per operation, least recently used entries are evicted
+    for (int i = 0; i < 32; ++i)
+        Stratum::Exec<LayerOpAdd>(layertest::CountedAdd, i, i);
+    EXPECT_LE(Memo::Size<LayerOpAdd>(), 4u);
+    EXPECT_EQ(layertest::CoreCalls, 33);
+
+    // Batches short-circuit per element
+    std::vector<LayerOpAdd::BatchArguments> inputs = { { 31, 31 }, { 40, 2 } };
+    std::vector<int> results(inputs.size());
+    Stratum::ExecBatch<LayerOpAdd>(layertest::CountedAdd, inputs, results);
+    EXPECT_EQ(results, (std::vector<int>{ 62, 42 }));
+    EXPECT_EQ(layertest::CoreCalls, 34);
+
+    // Void operations end the call with Skip
+    auto metrics = LayerStateManager<MetricsLayer::Data>::global();
+    const int printed = metrics.read().operationCount;
+    Strata<MuteLayer, MetricsLayer>::Exec<LayerOpPrint>(layertest::Print, "# muted");
+    Strata<MuteLayer, MetricsLayer>::Exec<LayerOpPrint>(layertest::Print, "Not muted");
+    EXPECT_EQ(metrics.read().operationCount, printed + 1);
+}
+
+TEST_F(LayerUsageTests, MemoizeSpreadsShards)
+{
+    struct LayerOpSpread : LayerOp<int, int, int> {};
+    using Memo    = util::Memoize<1024, 16>;
+    using Stratum = Strata<Memo>;
+    layertest::CoreCalls = 0;
+
+    // More distinct small keys than one shard holds, all of them must stay cached
+    constexpr int kKeys = 200;
+    for (int i = 0; i < kKeys; ++i)
+        EXPECT_EQ(Stratum::Exec<LayerOpSpread>(layertest::CountedAdd, i, 0), i);
+    EXPECT_EQ(Memo::Size<LayerOpSpread>(), static_cast<std::size_t>(kKeys));
+
+    for (int i = 0; i < kKeys; ++i)
+        EXPECT_EQ(Stratum::Exec<LayerOpSpread>(layertest::CountedAdd, i, 0), i);
+    EXPECT_EQ(layertest::CoreCalls, kKeys);
+}
+
+// Normally the extern declaration sits in a header and the definition in one source file
+using InstantiatedStack = Strata<ValidationLayer, MetricsLayer>;
+STRATA_EXTERN_INSTANTIATION(InstantiatedStack, LayerOpAdd);
+STRATA_INSTANTIATE(InstantiatedStack, LayerOpAdd);
+
+TEST_F(LayerUsageTests, ExplicitInstantiation)
+{
+    using Instantiated = Dispatch<InstantiatedStack, LayerOpAdd>;
+
+    EXPECT_EQ(Instantiated::Call(layertest::Add, 2, 3), 5);
+    EXPECT_THROW(Instantiated::Call(layertest::Add, -1, 3), std::invalid_argument);
+    EXPECT_EQ(LayerStateManager<MetricsLayer::Data>::global().read().operationCount, 1);
+}
+
+#if STRATA_HAS_COROUTINES
+namespace layertest
+{
+    // Completes on another thread, like an I/O callback
+    struct ResumeOnThread
+    {
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { std::thread([handle] { handle.resume(); }).detach(); }
+        void await_resume() {}
+    };
+
+    Task<int> AddAsync(int a, int b) {
+        co_await ResumeOnThread {};
+        if (a + b > 100)
+            throw std::overflow_error("Sum too large");
+        co_return a + b;
+    }
+}
+
+struct AsyncAuditLayer
+{
+    struct Data
+    {
+        std::vector<int> entries;
+    };
+
+    template<typename Op>
+    struct Impl {
+        // Awaited before the core, the awaited value is the token
+        static Task<int> Before(int a, int) {
+            co_await layertest::ResumeOnThread {};
+            co_return a * 100;
+        }
+        static void After(int token, int& result, int, int) {
+            LayerStateManager<AsyncAuditLayer::Data>::global()->entries.push_back(token + result);
+        }
+    };
+};
+
+template<> struct LayerTraits<AsyncAuditLayer> { static constexpr bool compiletimeEnabled = true; };
+
+TEST_F(LayerUsageTests, ExecAsync)
+{
+    using Stratum = Strata<AsyncAuditLayer, ValidationLayer, MetricsLayer>;
+
+    EXPECT_EQ(SyncWait(Stratum::ExecAsync<LayerOpAdd>(layertest::AddAsync, 2, 3)), 5);
+    EXPECT_EQ(SyncWait(Stratum::ExecAsync<LayerOpAdd>(layertest::AddAsync, 4, 5)), 9);
+
+    // After ran on completion with the finished result
+    EXPECT_EQ(LayerStateManager<AsyncAuditLayer::Data>::global().read().entries, (std::vector<int>{ 205, 409 }));
+    EXPECT_EQ(LayerStateManager<MetricsLayer::Data>::global().read().operationCount, 2);
+
+    EXPECT_THROW(SyncWait(Stratum::ExecAsync<LayerOpAdd>(layertest::AddAsync, -1, 1)), std::invalid_argument);
+    EXPECT_THROW(SyncWait(Stratum::ExecAsync<LayerOpAdd>(layertest::AddAsync, 100, 1)), std::overflow_error);
+    EXPECT_EQ(SyncWait(Strata<>::ExecAsync<LayerOpAdd>(layertest::AddAsync, 1, 1)), 2);
+
+    // A synchronous short-circuit ends the coroutine without awaiting the core
+    using Memoized = Strata<AsyncAuditLayer, util::Memoize<>>;
+    EXPECT_EQ(SyncWait(Memoized::ExecAsync<LayerOpAdd>(layertest::AddAsync, 7, 8)), 15);
+    EXPECT_EQ(SyncWait(Memoized::ExecAsync<LayerOpAdd>(layertest::AddAsync, 7, 8)), 15);
+    EXPECT_EQ(LayerStateManager<AsyncAuditLayer::Data>::global().read().entries.back(), 715);
+    EXPECT_EQ(util::Memoize<>::Size<LayerOpAdd>(), 1u);
+}
+#endif
@@ -101,3 +101,83 @@ TEST_F(utilTest, LayerFilterExec)
 
     EXPECT_EQ(result, 5);
 }
+
+TEST_F(utilTest, LatencyDistributionBuckets)
+{
+    using Dist = util::LatencyDistribution;
+
+    for (std::uint64_t value : {0ull, 1ull, 15ull, 16ull, 17ull, 1000ull, 123456ull, 987654321ull}) {
+        auto index = Dist::BucketIndex(value);
+        ASSERT_LT(index, Dist::kBucketCount);
+        EXPECT_GE(Dist::BucketUpperBound(index), value);
+        EXPECT_LE(Dist::BucketUpperBound(index) - value, value / 16);
+        if (index > 0) {
+            EXPECT_LT(Dist::BucketUpperBound(index - 1), value);
+        }
+    }
+
+    EXPECT_EQ(Dist::BucketIndex(~0ull), Dist::kBucketCount - 1);
+
+    Dist dist;
+    for (std::uint64_t value = 1; value <= 100; ++value) {
+        dist.buckets[Dist::BucketIndex(value)]++;
+        dist.count++;
+        dist.total += value;
+        dist.min = std::min(dist.min, value);
+        dist.max = std::max(dist.max, value);
+    }
+    EXPECT_NEAR(static_cast<double>(dist.percentile(50)), 50.0, 50.0 / 16);
+    EXPECT_EQ(dist.percentile(100), 100u);
+    EXPECT_DOUBLE_EQ(dist.mean(), 50.5);
+}
+
+TEST_F(utilTest, Introspection)
+{
+    using Stratum = Strata<Layer1, Layer3>;
+    static_assert(Stratum::LayerNames.size() == 2);
+    static_assert(Stratum::LayerNames[0] == "Layer1");
+    static_assert(Stratum::OpName<LayerOp<int, int>> != std::string_view());
+
+    EXPECT_EQ(Stratum::LayerNames[1], "Layer3");
+    EXPECT_TRUE(util::LayerFilter<Layer2>::LayerNames.empty());
+}
+
+struct OuterLayer
+{
+    template<typename Op>
+    struct Impl {
+        template<typename... Args>
+        static void Before(Args&&...) {}
+    };
+};
+struct InnerLayer {};
+
+// Gate without hooks, never consulted once pruned
+struct GateOnlyLayer
+{
+    static inline int gateChecks = 0;
+
+    template<typename Op>
+    static bool Active() { return ++gateChecks > 0; }
+};
+
+template<> struct LayerTraits<OuterLayer> { static constexpr bool compiletimeEnabled = true; static constexpr int priority = 10; };
+template<> struct LayerTraits<InnerLayer> { static constexpr bool compiletimeEnabled = true; static constexpr int priority = -5; };
+template<> struct LayerTraits<GateOnlyLayer> { static constexpr bool compiletimeEnabled = true; };
+
+TEST_F(utilTest, OrderingAndPruning)
+{
+    // Highest priority outermost, equal priorities keep their declared order
+    using Stratum = util::LayerFilter<Layer1, InnerLayer, Layer2, GateOnlyLayer, Layer3, OuterLayer>;
+    static_assert(std::is_same_v<Stratum, Strata<OuterLayer, Layer1, GateOnlyLayer, Layer3, InnerLayer>>);
+    static_assert(std::is_same_v<util::LayerFilter<InnerLayer, Layer3, OuterLayer, Layer1>, Strata<OuterLayer, Layer3, Layer1, InnerLayer>>);
+
+    // Only layers with hooks for the operation take part in it
+    struct PruneOp : LayerOp<int, int, int> {};
+    static_assert(std::is_same_v<Stratum::ForOp<PruneOp>, Strata<OuterLayer>>);
+    static_assert(std::is_same_v<Strata<Layer1, Layer3>::ForOp<PruneOp>, Strata<>>);
+
+    auto add = [](int a, int b) { return a + b; };
+    EXPECT_EQ(Stratum::Exec<PruneOp>(add, 2, 3), 5);
+    EXPECT_EQ(GateOnlyLayer::gateChecks, 0);
+}
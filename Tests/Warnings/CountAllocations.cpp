@@ -0,0 +1,40 @@
+// Built with warnings as errors: STRATA_COUNT_ALLOCATIONS() must expand cleanly
+// next to the usual containers and smart pointers
+#include <strata.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+STRATA_COUNT_ALLOCATIONS()
+
+namespace
+{
+    struct LayerOpCollect : strata::LayerOp<std::size_t, int> {};
+
+    std::size_t Collect(int count)
+    {
+        std::vector<std::string>        names;
+        std::map<int, std::vector<int>> buckets;
+        for (int i = 0; i < count; ++i)
+        {
+            names.push_back(std::string(32, static_cast<char>('a' + i % 26)));
+            buckets[i % 4].push_back(i);
+        }
+
+        auto owned  = std::make_unique<int[]>(static_cast<std::size_t>(count) + 1);
+        auto shared = std::make_shared<std::string>(names.empty() ? std::string() : names.front());
+        int* raw    = new int(count);
+        owned[0]    = *raw;
+        delete raw;
+        return names.size() + buckets.size() + shared->size() + static_cast<std::size_t>(owned[0]);
+    }
+}
+
+int main()
+{
+    using Stratum = strata::Strata<strata::util::AllocationCounter>;
+    Stratum::Exec<LayerOpCollect>(Collect, 64);
+    return strata::util::AllocationCounter::Snapshot<LayerOpCollect>().allocations > 0 ? 0 : 1;
+}
@@ -1,16 +1,60 @@
 #pragma once
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <list>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <new>
+#include <optional>
 #include <shared_mutex>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
 #include <type_traits>
-#include <typeindex>
 #include <typeinfo>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#if __has_include(<span>)
+    #include <span>
+#endif
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+    #include <coroutine>
+    #define STRATA_HAS_COROUTINES 1
+#else
+    #define STRATA_HAS_COROUTINES 0
+#endif
 
 namespace strata
 {
@@ -35,450 +79,5494 @@ namespace strata
     template <typename Ret, typename F, typename... Args>
     constexpr bool is_invocable_r_v = is_invocable_r<Ret, F, Args...>::value;
 
-    template <typename Ret, typename... Args>
-    struct LayerOp
+    /// @brief Base traits for controlling layer enablement at compile time
+    ///
+    /// Specializations may additionally declare `static constexpr bool runtimeEnabled`
+    /// to make a compiled-in layer switchable at runtime, see util::SetRuntimeEnabled,
+    /// `static constexpr int priority` to order it within util::LayerFilter,
+    /// `static constexpr bool usesScratch` when its hooks allocate from ScratchArena, and
+    /// `static constexpr bool traceHooks` to override whether util::ChromeTrace records its hooks.
+    template <typename T>
+    struct LayerTraits
     {
-        using Function   = Ret (*)(Args...);
-        using ReturnType = Ret;
-        using Arguments  = std::tuple<Args...>;
-
-        template <typename F>
-        static constexpr bool validates_function = is_invocable_r_v<ReturnType, F, Args...>;
+        static constexpr bool compiletimeEnabled = false;
     };
 
-    /// @brief Main layer composition template
+    /// @brief Declares whether a layer's hooks may run concurrently in a parallel ExecBatch
     ///
-    /// Combines multiple layers into a processing pipeline where each layer can
-    /// intercept operations before and after execution.
-    template <typename... Layers>
-    struct Strata
+    /// Hooks of layers left at the default are serialized per layer while the batch runs.
+    /// `deferAfter` moves the layer's After off the calling thread, see DeferredAfterQueue;
+    /// calls whose token or arguments are not DeferrableArgument still run it inline.
+    /// Specializations only need to declare the members they change.
+    template <typename T>
+    struct LayerConcurrencyTraits
     {
-        /// @brief Executes an operation through all enabled layers
-        ///
-        /// @tparam Op Operation type that defines return type and arguments
-        /// @tparam Func Signature of the function to execute
-        /// @tparam Args Types of the arguments
-        ///
-        /// @param func Core function to wrap in layers
-        /// @param args Arguments to pass through layers to the function
-        /// @return ReturnT Result of the operation
-        template <typename Op, typename Func, typename... Args>
-        static typename Op::ReturnType Exec(Func&& func, Args&&... args)
-        {
-            static_assert(Op::template validates_function<Func>,
-                "Function signature does not match operation definition");
-
-            #define CORE_FUNC() std::forward<Func>(func)(std::forward<Args>(args)...)
-            {
-                if constexpr (sizeof...(Layers) == 0)
-                {
-                    if constexpr (std::is_void_v<typename Op::ReturnType>)
-                        CORE_FUNC();
-                    else
-                        return CORE_FUNC();
-                }
-
-                #ifdef DEBUG
-                    auto currentOperation = { typeid(Op).name(), typeid(func).name() };
-                    if constexpr (sizeof...(Layers) > 0)
-                        auto enabledLayers = { typeid(Layers).name()... };
-                #endif
+        static constexpr bool threadSafe = false;
+        static constexpr bool deferAfter = false;
+    };
 
-                (ApplyBeforeIfExists<Op, Layers>(std::forward<Args>(args)...), ...);
+    namespace detail
+    {
+        inline constexpr std::size_t kCacheLineSize = 64;
 
-                if constexpr (std::is_void_v<typename Op::ReturnType>)
-                {
-                    CORE_FUNC();
-                    ApplyAfterIfExists<Op, Layers...>(std::forward<Args>(args)...);
-                }
-                else
-                {
-                    typename Op::ReturnType result = CORE_FUNC();
-                    ApplyAfterIfExists<Op, typename Op::ReturnType, Layers...>(result, std::forward<Args>(args)...);
-                    return result;
-                }
-            }
-            #undef CORE_FUNC
-        }
+        template <typename Layer, typename = void>
+        struct runtime_toggle : std::false_type
+        {};
 
-        // Helper to add new layers to the front
-        template <typename NewLayer>
-        using PrependLayer = Strata<NewLayer, Layers...>;
+        template <typename Layer>
+        struct runtime_toggle<Layer, std::void_t<decltype(LayerTraits<Layer>::runtimeEnabled)>> : std::true_type
+        {};
 
-    private:
-        template <typename Op, typename Layer, typename... Args>
-        static void ApplyBeforeIfExists(Args&&... args)
+        /// @brief Enable bits of all runtime-toggleable layers, read once per Exec
+        inline std::atomic<std::uint64_t>& RuntimeLayerMask()
         {
-            if constexpr (has_specific_before_impl<Layer, Op>::value)
-                Layer::template Impl<Op>::Before(std::forward<Args>(args)...);
-            else if constexpr (has_generic_before_impl<Layer, Args...>::value)
-                Layer::template Impl<Op>::Before(std::forward<Args>(args)...);
+            alignas(kCacheLineSize) static std::atomic<std::uint64_t> mask { 0 };
+            return mask;
         }
 
-        // After is called recursively to wrap function symmetrically
-        // Helper for value-returning operations
-        template <typename Op, typename ReturnT, typename First, typename... Rest, typename... Args>
-        static void ApplyAfterIfExists(ReturnT& result, Args&&... args)
+        inline std::uint64_t AllocateRuntimeLayerBit(bool enabled)
         {
-            if constexpr (sizeof...(Rest) > 0)
-                ApplyAfterIfExists<Op, ReturnT, Rest...>(result, std::forward<Args>(args)...);
+            static std::atomic<std::uint32_t> nextBit { 0 };
+            auto                              index = nextBit.fetch_add(1, std::memory_order_relaxed);
+            if (index >= 64)
+                throw std::length_error("strata supports at most 64 runtime-toggleable layers");
 
-            if constexpr (has_specific_after_impl<First, Op>::value)
-                First::template Impl<Op>::After(result, std::forward<Args>(args)...);
-            else if constexpr (has_generic_after_impl<First, ReturnT, Args...>::value)
-                First::template Impl<Op>::After(result, std::forward<Args>(args)...);
+            const std::uint64_t bit = std::uint64_t { 1 } << index;
+            if (enabled)
+                RuntimeLayerMask().fetch_or(bit, std::memory_order_relaxed);
+            return bit;
         }
 
-        // Helper for void-returning operations
-        template <typename Op, typename First, typename... Rest, typename... Args>
-        static void ApplyAfterIfExists(Args&&... args)
-        {
-            if constexpr (sizeof...(Rest) > 0)
-                ApplyAfterIfExists<Op, Rest...>(std::forward<Args>(args)...);
+        template <typename Layer, typename = void>
+        struct thread_safe_hooks : std::false_type
+        {};
 
-            if constexpr (has_specific_after_impl<First, Op>::value)
-                First::template Impl<Op>::After(std::forward<Args>(args)...);
-            else if constexpr (has_generic_after_impl<First, void, Args...>::value)
-                First::template Impl<Op>::After(std::forward<Args>(args)...);
-        }
+        template <typename Layer>
+        struct thread_safe_hooks<Layer, std::void_t<decltype(LayerConcurrencyTraits<Layer>::threadSafe)>> : std::bool_constant<LayerConcurrencyTraits<Layer>::threadSafe>
+        {};
 
-        // SFINAE helpers to detect if a layer has an implementation for an operation
-        template <typename Layer, typename Op, typename = void>
-        struct has_specific_before_impl : std::false_type
+        template <typename Layer, typename = void>
+        struct defer_after : std::false_type
         {};
 
-        template <typename Layer, typename Op, typename = void>
-        struct has_specific_after_impl : std::false_type
+        template <typename Layer>
+        struct defer_after<Layer, std::void_t<decltype(LayerConcurrencyTraits<Layer>::deferAfter)>> : std::bool_constant<LayerConcurrencyTraits<Layer>::deferAfter>
         {};
 
-        template <typename Layer, typename Op>
-        struct has_specific_before_impl<Layer, Op, std::void_t<decltype(Layer::template Impl<Op>::Before)>> : std::true_type
+        template <typename Layer, typename = void>
+        struct uses_scratch : std::false_type
         {};
 
-        template <typename Layer, typename Op>
-        struct has_specific_after_impl<Layer, Op, std::void_t<decltype(Layer::template Impl<Op>::After)>> : std::true_type
+        template <typename Layer>
+        struct uses_scratch<Layer, std::void_t<decltype(LayerTraits<Layer>::usesScratch)>> : std::bool_constant<LayerTraits<Layer>::usesScratch>
         {};
 
-        template <typename Layer, typename... Args>
-        struct has_generic_before_impl
+        template <typename Layer, bool kDefault, typename = void>
+        struct trace_hooks : std::bool_constant<kDefault>
+        {};
+
+        template <typename Layer, bool kDefault>
+        struct trace_hooks<Layer, kDefault, std::void_t<decltype(LayerTraits<Layer>::traceHooks)>> : std::bool_constant<LayerTraits<Layer>::traceHooks>
+        {};
+
+        template <typename Layer>
+        std::mutex& LayerHookMutex()
         {
-            template <typename T>
-            static auto test(int) -> decltype(T::template Impl<void>::Before(std::declval<Args>()...), std::true_type {});
+            static std::mutex mutex;
+            return mutex;
+        }
 
-            template <typename>
-            static auto test(...) -> std::false_type;
+        template <typename Layer>
+        std::uint64_t RuntimeLayerBit()
+        {
+            static const std::uint64_t bit = AllocateRuntimeLayerBit(LayerTraits<Layer>::runtimeEnabled);
+            return bit;
+        }
 
-            static constexpr bool value = decltype(test<Layer>(0))::value;
+        // Decorator layers (e.g. util::Sampled) expose the layer whose hooks they run
+        template <typename Layer, typename = void>
+        struct hook_layer
+        {
+            using type = Layer;
         };
 
-        template <typename Layer, typename ReturnT, typename... Args>
-        struct has_generic_after_impl
+        template <typename Layer>
+        struct hook_layer<Layer, std::void_t<typename Layer::HookLayer>>
         {
-            template <typename T>
-            static auto test(int) -> decltype(T::template Impl<void>::After(std::declval<ReturnT&>(), std::declval<Args>()...), std::true_type {});
+            using type = typename Layer::HookLayer;
+        };
 
-            template <typename>
-            static auto test(...) -> std::false_type;
+        template <typename Layer>
+        using hook_layer_t = typename hook_layer<Layer>::type;
 
-            static constexpr bool value = decltype(test<Layer>(0))::value;
-        };
+        // Placeholder token for layers whose Before returns nothing
+        struct NoToken
+        {};
+
+        template <typename T>
+        constexpr std::string_view RawTypeName()
+        {
+            #if defined(_MSC_VER)
+                return __FUNCSIG__;
+            #else
+                return __PRETTY_FUNCTION__;
+            #endif
+        }
+
+        // The decorated signature of a known type locates the name inside it
+        inline constexpr std::size_t kTypeNamePrefix = RawTypeName<int>().find("int");
+        inline constexpr std::size_t kTypeNameSuffix = RawTypeName<int>().size() - kTypeNamePrefix - 3;
+
+        constexpr std::string_view StripTypeKeyword(std::string_view name)
+        {
+            for (std::string_view keyword : { std::string_view("struct "), std::string_view("class "), std::string_view("enum ") })
+            {
+                if (name.substr(0, keyword.size()) == keyword)
+                    return name.substr(keyword.size());
+            }
+            return name;
+        }
+
+        /// @brief Readable name of a type, resolved entirely at compile time
+        template <typename T>
+        constexpr std::string_view TypeName()
+        {
+            constexpr std::string_view raw = RawTypeName<T>();
+            return StripTypeKeyword(raw.substr(kTypeNamePrefix, raw.size() - kTypeNamePrefix - kTypeNameSuffix));
+        }
+    }
+
+    template <typename Ret, typename... Args>
+    struct LayerOp
+    {
+        using Function   = Ret (*)(Args...);
+        using ReturnType = Ret;
+        using Arguments  = std::tuple<Args...>;
+
+        /// @brief Owned argument values of one call, the element type of ExecBatch inputs
+        using BatchArguments = std::tuple<std::decay_t<Args>...>;
+
+        template <typename F>
+        static constexpr bool validates_function = is_invocable_r_v<ReturnType, F, Args...>;
     };
 
-    /// @brief Base traits for controlling layer enablement at compile time
+    /// @brief Non-owning view over contiguous elements
     template <typename T>
-    struct LayerTraits
+    class Span
     {
-        static constexpr bool compiletimeEnabled = false;
+    private:
+        T*          data_ = nullptr;
+        std::size_t size_ = 0;
+
+    public:
+        constexpr Span() noexcept = default;
+        constexpr Span(T* data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+        template <std::size_t N>
+        constexpr Span(T (&array)[N]) noexcept : data_(array), size_(N)
+        {}
+
+        template <typename Container, typename = std::enable_if_t<std::is_convertible_v<decltype(std::declval<Container&>().data()), T*>>>
+        constexpr Span(Container& container) noexcept : data_(container.data()), size_(container.size())
+        {}
+
+        constexpr T*          data() const noexcept { return data_; }
+        constexpr std::size_t size() const noexcept { return size_; }
+        constexpr bool        empty() const noexcept { return size_ == 0; }
+        constexpr T*          begin() const noexcept { return data_; }
+        constexpr T*          end() const noexcept { return data_ + size_; }
+        constexpr T&          operator[](std::size_t index) const noexcept { return data_[index]; }
+
+        constexpr Span subspan(std::size_t offset, std::size_t count) const noexcept { return Span(data_ + offset, count); }
     };
 
+    /// @brief Whether a deferred After may keep its own copy of a T argument
+    ///
+    /// Deferred hooks run after the caller returned, so only values that own their data
+    /// may be queued. Pointers, string views, Spans and reference wrappers are rejected,
+    /// and a deferAfter layer receiving one runs that After inline. Specialize to opt a
+    /// type in, e.g. a pointer to data that outlives every call.
+    template <typename T>
+    struct DeferrableArgument : std::bool_constant<std::is_copy_constructible_v<T> && !std::is_pointer_v<T> && !std::is_member_pointer_v<T>>
+    {};
 
-    ////////////////////////////////////////
-    // Utilities
-    ////////////////////////////////////////
+    template <typename Char, typename CharTraits>
+    struct DeferrableArgument<std::basic_string_view<Char, CharTraits>> : std::false_type
+    {};
 
-    namespace util
+    template <typename T>
+    struct DeferrableArgument<Span<T>> : std::false_type
+    {};
+
+    template <typename T>
+    struct DeferrableArgument<std::reference_wrapper<T>> : std::false_type
+    {};
+
+#ifdef __cpp_lib_span
+    template <typename T, std::size_t Extent>
+    struct DeferrableArgument<std::span<T, Extent>> : std::false_type
+    {};
+#endif
+
+    /// @brief Result of a Before hook that may end the call early
+    ///
+    /// Holding a value skips the core function and all inner layers; the outer layers'
+    /// After hooks then see that value as the result. A default-constructed ShortCircuit
+    /// continues the call. Continue(token) continues it and hands the token to the layer's
+    /// own After, which otherwise receives no token.
+    ///
+    /// @tparam T Result type of the operation, `void` operations end the call with Skip()
+    /// @tparam Token Optional token passed to After when the call continues
+    template <typename T, typename Token = void>
+    class ShortCircuit
     {
-        /// @brief Define a template alias for all available layers
-        template<typename... Layers>
-        using LayerPack = std::tuple<Layers...>;
+    public:
+        using Value      = std::conditional_t<std::is_void_v<T>, detail::NoToken, T>;
+        using value_type = std::conditional_t<std::is_void_v<Token>, detail::NoToken, Token>;
 
-        /// @brief Helper to inspect enabled layers
-        template <typename LayerPackType>
-        struct EnabledLayerInfo
+    private:
+        std::optional<Value>      value_;
+        std::optional<value_type> token_;
+
+    public:
+        ShortCircuit() = default;
+        ShortCircuit(Value value) : value_(std::move(value)) {}
+
+        /// @brief End a void operation without calling the core
+        static ShortCircuit Skip() { return ShortCircuit(Value {}); }
+
+        /// @brief Continue the call and pass token to this layer's After
+        static ShortCircuit Continue(value_type token)
         {
-            static constexpr auto enabled = detail::LayerPackHelper<LayerPackType>::template Apply<detail::EnabledLayerInfoImpl>::enabled;
-        };
+            ShortCircuit result;
+            result.token_.emplace(std::move(token));
+            return result;
+        }
 
-        /// @brief Check if a single layer is enabled
-        template<typename Layer>
-        inline constexpr bool IsLayerEnabled = LayerTraits<Layer>::compiletimeEnabled;
+        explicit operator bool() const noexcept { return value_.has_value(); }
+        Value&   value() { return *value_; }
 
-        /// @brief Count enabled layers
-        template<typename LayerPackType>
-        constexpr size_t CountEnabledLayers = detail::LayerPackHelper<LayerPackType>::template ApplyValue<detail::CountEnabledLayersImpl>;
+        bool        hasToken() const noexcept { return token_.has_value(); }
+        value_type& token() { return *token_; }
+    };
 
-        /// @brief Check if any layers are enabled
-        template<typename LayerPackType>
-        inline constexpr bool AnyLayersEnabled = detail::LayerPackHelper<LayerPackType>::template ApplyValue<detail::AnyLayersEnabledImpl>;
+    namespace detail
+    {
+        template <typename T>
+        struct is_short_circuit : std::false_type
+        {};
 
-        // Forward declaration
-        namespace detail { template <typename... Layers> struct LayerFilterImpl; }
+        template <typename T, typename Token>
+        struct is_short_circuit<ShortCircuit<T, Token>> : std::true_type
+        {};
 
-        // LayerFilter with SFINAE to handle both LayerPack and individual layers
-        /// @brief Provides Strata<Layers...> type with only enabled layers
-        /// Can be used to call Exec<Op>(func, args...)
-        /// Any <Layers...> with compiletimeEnabled = false are filtered out
-        template <typename... Layers>
-        using LayerFilter = typename detail::LayerFilterImpl<Layers...>::type;
+        // How After receives the token stored for it: engaged optionals and continued
+        // ShortCircuits pass their value, NoToken and token-less ShortCircuits pass nothing
+        template <typename Token>
+        struct hook_token
+        {
+            static constexpr bool kPassed = true;
+            using value_type              = typename Token::value_type;
 
-        namespace detail
+            static bool        Has(const Token& token) { return token.has_value(); }
+            static value_type& Get(Token& token) { return *token; }
+        };
+
+        template <>
+        struct hook_token<NoToken>
         {
-            // Helper to work with LayerPack
-            template<typename T>
-            struct LayerPackHelper;
+            static constexpr bool kPassed = false;
+        };
+
+        template <typename T>
+        struct hook_token<ShortCircuit<T, void>>
+        {
+            static constexpr bool kPassed = false;
+        };
 
+        template <typename T, typename Token>
+        struct hook_token<ShortCircuit<T, Token>>
+        {
+            static constexpr bool kPassed = true;
+            using value_type              = Token;
 
-            template<typename... Layers>
-            struct LayerPackHelper<LayerPack<Layers...>>
+            static bool   Has(const ShortCircuit<T, Token>& token) { return token.hasToken(); }
+            static Token& Get(ShortCircuit<T, Token>& token) { return token.token(); }
+        };
+
+        template <typename Token>
+        bool Tripped([[maybe_unused]] const Token& token)
+        {
+            if constexpr (is_short_circuit<Token>::value)
+                return static_cast<bool>(token);
+            else
+                return false;
+        }
+    }
+
+    namespace detail
+    {
+        // Stand-in for the results span of void operations
+        struct NoResults
+        {};
+
+        // Runs a batch on the calling thread as a single range
+        struct InlineExecutor
+        {
+            template <typename Task>
+            void ParallelFor(std::size_t count, Task&& task)
             {
-                template<template<typename...> class F>
-                using Apply = F<Layers...>;
+                if (count > 0)
+                    task(std::size_t { 0 }, count);
+            }
+        };
+    }
 
-                template<template<typename...> class F>
-                static constexpr auto ApplyValue = F<Layers...>::value;
-            };
+#if STRATA_HAS_COROUTINES
+    template <typename T = void>
+    class Task;
 
+    namespace detail
+    {
+        template <typename T>
+        struct TaskResult
+        {
+            std::optional<T> value;
 
-            // Type trait to check if a type is a LayerPack
-            template<typename T>
-            struct is_layer_pack : std::false_type {};
+            void return_value(T result) { value.emplace(std::move(result)); }
+            T    take() { return std::move(*value); }
+        };
 
-            template<typename... Layers>
-            struct is_layer_pack<LayerPack<Layers...>> : std::true_type {};
+        template <>
+        struct TaskResult<void>
+        {
+            void return_void() noexcept {}
+            void take() noexcept {}
+        };
 
-            /// @brief Helper to filter enabled layers at compile time
-            template <typename... AllLayers>
-            struct EnabledLayers
+        // Fire-and-forget coroutine used to drive a Task from synchronous code
+        struct DetachedTask
+        {
+            struct promise_type
             {
-                using type = Strata<>;
+                DetachedTask        get_return_object() noexcept { return {}; }
+                std::suspend_never  initial_suspend() noexcept { return {}; }
+                std::suspend_never  final_suspend() noexcept { return {}; }
+                void                return_void() noexcept {}
+                [[noreturn]] void   unhandled_exception() noexcept { std::terminate(); }
             };
+        };
+
+        template <typename T, typename = void>
+        struct is_awaiter : std::false_type
+        {};
+
+        template <typename T>
+        struct is_awaiter<T, std::void_t<decltype(std::declval<T&>().await_ready()), decltype(std::declval<T&>().await_resume())>> : std::true_type
+        {};
 
-            template <typename FirstLayer, typename... RestLayers>
-            struct EnabledLayers<FirstLayer, RestLayers...>
+        /// @brief Awaits a hook's awaiter when present, optionally keeping its result as the token
+        template <typename Awaiter, typename Token>
+        struct HookAwaiter
+        {
+            std::optional<Awaiter> awaiter;
+            Token*                 token = nullptr;
+
+            bool await_ready() { return !awaiter || awaiter->await_ready(); }
+
+            template <typename Handle>
+            auto await_suspend(Handle handle)
             {
-                using type = std::conditional_t<
-                    LayerTraits<FirstLayer>::compiletimeEnabled,
-                    typename EnabledLayers<RestLayers...>::type::template PrependLayer<FirstLayer>,
-                    typename EnabledLayers<RestLayers...>::type>;
-            };
+                return awaiter->await_suspend(handle);
+            }
 
-                // LayerFilter implementation
-            template <typename... Layers>
-            struct LayerFilterImpl
+            void await_resume()
             {
-                using type = typename EnabledLayers<Layers...>::type;
+                if (!awaiter)
+                    return;
+
+                if constexpr (std::is_same_v<Token, NoToken>)
+                    awaiter->await_resume();
+                else
+                    token->emplace(awaiter->await_resume());
+            }
+        };
+    }
+
+    /// @brief Lazily started coroutine returned by Strata::ExecAsync
+    ///
+    /// Runs when awaited and resumes the awaiting coroutine on completion.
+    /// Use SyncWait to drive one from synchronous code.
+    template <typename T>
+    class Task
+    {
+    public:
+        struct promise_type : detail::TaskResult<T>
+        {
+            std::coroutine_handle<> continuation = std::noop_coroutine();
+            std::exception_ptr      error;
+
+            Task                get_return_object() noexcept { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            void                unhandled_exception() noexcept { error = std::current_exception(); }
+
+            auto final_suspend() noexcept
+            {
+                struct FinalAwaiter
+                {
+                    bool                    await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept { return handle.promise().continuation; }
+                    void                    await_resume() noexcept {}
+                };
+                return FinalAwaiter {};
+            }
+        };
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+
+        explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+    public:
+        Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+        Task(const Task&) = delete;
+
+        Task& operator=(Task&& other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle_)
+                    handle_.destroy();
+                handle_ = std::exchange(other.handle_, {});
+            }
+            return *this;
+        }
+
+        ~Task()
+        {
+            if (handle_)
+                handle_.destroy();
+        }
+
+        bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle_.promise().continuation = awaiting;
+            return handle_;
+        }
+
+        T await_resume()
+        {
+            if (handle_.promise().error)
+                std::rethrow_exception(handle_.promise().error);
+            return handle_.promise().take();
+        }
+    };
+
+    /// @brief Blocks the calling thread until the task completes and returns its result
+    template <typename T>
+    T SyncWait(Task<T> task)
+    {
+        std::mutex              mutex;
+        std::condition_variable finished;
+        bool                    done = false;
+        std::exception_ptr      error;
+        std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> result;
+
+        auto driver = [&]() -> detail::DetachedTask {
+            try
+            {
+                if constexpr (std::is_void_v<T>)
+                    co_await std::move(task);
+                else
+                    result.emplace(co_await std::move(task));
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+            finished.notify_one();
+        };
+        driver();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return done; });
+
+        if (error)
+            std::rethrow_exception(error);
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*result);
+    }
+#endif
+
+    /// @brief Bounded lock-free MPSC ring that runs deferred After hooks on a background thread
+    ///
+    /// Exec copies the token, result and arguments of a deferred After into a ring slot;
+    /// a single drain thread invokes the hook later. When the ring is full, or a snapshot
+    /// does not fit a slot, the hook runs inline instead so nothing is lost. Exceptions
+    /// thrown by deferred hooks are counted and discarded. Deferred hooks see copies, so
+    /// changes they make to the result or arguments do not reach the caller. Calls with a
+    /// token or argument that does not own its data, see DeferrableArgument, stay inline.
+    class DeferredAfterQueue
+    {
+    public:
+        static constexpr std::size_t kCapacity = 4096;
+        static constexpr std::size_t kSlotSize = 192;
+
+    private:
+        struct alignas(detail::kCacheLineSize) Slot
+        {
+            std::atomic<std::size_t> sequence { 0 };
+            void (*run)(void* job) = nullptr;
+            alignas(std::max_align_t) unsigned char storage[kSlotSize];
+        };
+
+        std::unique_ptr<Slot[]> slots_;
+
+        alignas(detail::kCacheLineSize) std::atomic<std::size_t> head_ { 0 };
+        alignas(detail::kCacheLineSize) std::atomic<std::size_t> consumed_ { 0 };
+        std::atomic<std::size_t> failures_ { 0 };
+        std::atomic<bool>        sleeping_ { false };
+        std::atomic<bool>        stop_ { false };
+        std::mutex               mutex_;
+        std::condition_variable  wake_;
+        std::condition_variable  drained_;
+        std::thread              worker_;
+
+        DeferredAfterQueue()
+            : slots_(new Slot[kCapacity])
+        {
+            for (std::size_t i = 0; i < kCapacity; ++i)
+                slots_[i].sequence.store(i, std::memory_order_relaxed);
+            worker_ = std::thread([this] { drain(); });
+        }
+
+        template <typename Job>
+        static void Run(void* job)
+        {
+            auto& callable = *static_cast<Job*>(job);
+            try
+            {
+                callable();
+            }
+            catch (...)
+            {
+                GetInstance().failures_.fetch_add(1, std::memory_order_relaxed);
+            }
+            callable.~Job();
+        }
+
+        bool runNext()
+        {
+            const std::size_t position = consumed_.load(std::memory_order_relaxed);
+            Slot&             slot     = slots_[position % kCapacity];
+            if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+                return false;
+
+            slot.run(slot.storage);
+            slot.sequence.store(position + kCapacity, std::memory_order_release);
+            consumed_.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        void drain()
+        {
+            while (true)
+            {
+                while (runNext())
+                {}
+
+                std::unique_lock<std::mutex> lock(mutex_);
+                drained_.notify_all();
+                if (stop_)
+                    return;
+
+                // Producers only signal while the drain thread sleeps, the timeout covers the race
+                sleeping_.store(true, std::memory_order_seq_cst);
+                if (!hasPending())
+                    wake_.wait_for(lock, std::chrono::milliseconds(1));
+                sleeping_.store(false, std::memory_order_relaxed);
+            }
+        }
+
+        bool hasPending() const
+        {
+            const std::size_t position = consumed_.load(std::memory_order_relaxed);
+            return slots_[position % kCapacity].sequence.load(std::memory_order_acquire) == position + 1;
+        }
+
+    public:
+        ~DeferredAfterQueue()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            worker_.join();
+        }
+
+        static DeferredAfterQueue& GetInstance()
+        {
+            static DeferredAfterQueue instance;
+            return instance;
+        }
+
+        /// @brief Wait until every hook queued before the call has run
+        static void Flush()
+        {
+            auto&             queue  = GetInstance();
+            const std::size_t target = queue.head_.load(std::memory_order_acquire);
+
+            std::unique_lock<std::mutex> lock(queue.mutex_);
+            queue.wake_.notify_all();
+            queue.drained_.wait(lock, [&] { return queue.consumed_.load(std::memory_order_acquire) >= target; });
+        }
+
+        /// @brief Number of deferred hooks that threw
+        static std::size_t Failures() { return GetInstance().failures_.load(std::memory_order_relaxed); }
+
+        /// @brief Queue a callable, false when the ring is full or the callable too large
+        template <typename Job>
+        bool tryPush(Job&& job)
+        {
+            using Stored = std::decay_t<Job>;
+            if constexpr (sizeof(Stored) > kSlotSize || alignof(Stored) > alignof(std::max_align_t))
+            {
+                return false;
+            }
+            else
+            {
+                std::size_t position = head_.load(std::memory_order_relaxed);
+                Slot*       slot     = nullptr;
+                while (true)
+                {
+                    slot                       = &slots_[position % kCapacity];
+                    const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                    const auto        distance = static_cast<std::ptrdiff_t>(sequence - position);
+                    if (distance == 0)
+                    {
+                        if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (distance < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        position = head_.load(std::memory_order_relaxed);
+                    }
+                }
+
+                new (slot->storage) Stored(std::forward<Job>(job));
+                slot->run = &Run<Stored>;
+                slot->sequence.store(position + 1, std::memory_order_release);
+
+                if (sleeping_.load(std::memory_order_seq_cst))
+                    wake_.notify_one();
+                return true;
+            }
+        }
+    };
+
+    /// @brief Per-thread monotonic memory for the hooks of one operation
+    ///
+    /// Hooks build `std::pmr` containers on Resource(); allocating is a pointer bump and
+    /// deallocating does nothing. Exec opens a scope around each call of stacks with a layer
+    /// whose LayerTraits declare `usesScratch`, other stacks pay nothing. Everything is
+    /// released when the outermost scope of Op on the thread closes, so memory must not
+    /// outlive the call. ExecBatch opens one scope per element and one around each batch
+    /// hook; ExecAsync opens none, as its hooks may resume on another thread. Chunks beyond the
+    /// inline buffer come from a per-thread pool and are reused by later calls.
+    template <typename Op>
+    class ScratchArena
+    {
+    public:
+        static constexpr std::size_t kInlineSize = 4096;
+
+        /// @brief Keeps the arena alive until the outermost scope closes
+        class Scope
+        {
+        public:
+            Scope() { ++Local().depth_; }
+            ~Scope()
+            {
+                auto& arena = Local();
+                if (--arena.depth_ == 0)
+                    arena.arena_.release();
+            }
+
+            Scope(const Scope&)            = delete;
+            Scope& operator=(const Scope&) = delete;
+        };
+
+        static std::pmr::memory_resource* Resource() { return &Local().arena_; }
+
+        /// @brief Whether a scope is open on the calling thread
+        static bool InScope() { return Local().depth_ > 0; }
+
+    private:
+        alignas(std::max_align_t) unsigned char buffer_[kInlineSize];
+        std::pmr::unsynchronized_pool_resource pool_;
+        std::pmr::monotonic_buffer_resource    arena_ { buffer_, kInlineSize, &pool_ };
+        std::size_t                            depth_ = 0;
+
+        ScratchArena() = default;
+
+        static ScratchArena& Local()
+        {
+            static thread_local ScratchArena arena;
+            return arena;
+        }
+    };
+
+    namespace detail
+    {
+        /// @brief What a trace event names, one static instance per operation or layer hook
+        struct TraceSite
+        {
+            std::string_view name;
+            std::string_view category;
+            std::string_view hook;
+        };
+
+        template <typename Op>
+        inline constexpr TraceSite kCallTraceSite { TypeName<Op>(), "Exec", {} };
+
+        template <typename Layer, typename Op, bool kBefore>
+        inline constexpr TraceSite kHookTraceSite { TypeName<Layer>(), TypeName<Op>(), kBefore ? "Before" : "After" };
+
+        inline std::atomic<bool>& TraceCapturing()
+        {
+            static std::atomic<bool> capturing { true };
+            return capturing;
+        }
+
+        /// @brief Fixed-size ring of begin/end events written only by its thread
+        ///
+        /// Readers copy it without stopping the writer: `claimed_` moves before a slot is
+        /// overwritten and `head_` after, so a copy drops every slot that may have changed.
+        class TraceRing
+        {
+        public:
+            static constexpr std::size_t kCapacity = std::size_t { 1 } << 14;
+
+            struct Event
+            {
+                const TraceSite* site;
+                std::uint64_t    stamp;
+
+                bool          end() const { return stamp & 1; }
+                std::uint64_t nanos() const { return stamp >> 1; }
             };
 
-            // Specialization for LayerPack
-            template <typename... Layers>
-            struct LayerFilterImpl<LayerPack<Layers...>>
+        private:
+            struct Slot
             {
-                using type = typename EnabledLayers<Layers...>::type;
+                std::atomic<const TraceSite*> site { nullptr };
+                std::atomic<std::uint64_t>    stamp { 0 };
+            };
+
+            std::unique_ptr<Slot[]>                                       slots_;
+            alignas(kCacheLineSize) std::atomic<std::uint64_t>            claimed_ { 0 };
+            std::atomic<std::uint64_t>                                    head_ { 0 };
+            alignas(kCacheLineSize) std::atomic<std::uint64_t>            floor_ { 0 };
+            std::atomic<bool>                                             retired_ { false };
+            std::uint32_t                                                 thread_;
+
+        public:
+            explicit TraceRing(std::uint32_t thread) : slots_(new Slot[kCapacity]), thread_(thread) {}
+
+            std::uint32_t thread() const { return thread_; }
+            bool          retired() const { return retired_.load(std::memory_order_acquire); }
+            void          retire() { retired_.store(true, std::memory_order_release); }
+
+            void record(const TraceSite& site, bool end)
+            {
+                const auto nanos    = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+                const auto position = head_.load(std::memory_order_relaxed);
+
+                claimed_.store(position + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+
+                Slot& slot = slots_[position & (kCapacity - 1)];
+                slot.site.store(&site, std::memory_order_relaxed);
+                slot.stamp.store((static_cast<std::uint64_t>(nanos) << 1) | (end ? 1 : 0), std::memory_order_relaxed);
+                head_.store(position + 1, std::memory_order_release);
+            }
+
+            /// @brief Append the events recorded since the last clear(), oldest first
+            void copy(std::vector<Event>& into) const
+            {
+                const std::uint64_t head  = head_.load(std::memory_order_acquire);
+                const std::uint64_t first = std::max(floor_.load(std::memory_order_relaxed), head > kCapacity ? head - kCapacity : 0);
+                const std::size_t   start = into.size();
+
+                for (std::uint64_t i = first; i < head; ++i)
+                {
+                    const Slot& slot = slots_[i & (kCapacity - 1)];
+                    into.push_back({ slot.site.load(std::memory_order_relaxed), slot.stamp.load(std::memory_order_relaxed) });
+                }
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                const std::uint64_t claimed = claimed_.load(std::memory_order_relaxed);
+                if (claimed > kCapacity && claimed - kCapacity > first)
+                {
+                    const auto stale = static_cast<std::size_t>(std::min(claimed - kCapacity, head) - first);
+                    into.erase(into.begin() + static_cast<std::ptrdiff_t>(start), into.begin() + static_cast<std::ptrdiff_t>(start + stale));
+                }
+            }
+
+            void clear() { floor_.store(head_.load(std::memory_order_acquire), std::memory_order_relaxed); }
+        };
+
+        /// @brief Rings of all threads that recorded, kept after a thread exits until Clear
+        class TraceRegistry
+        {
+        private:
+            std::mutex                              mutex_;
+            std::vector<std::shared_ptr<TraceRing>> rings_;
+            std::uint32_t                           nextThread_ = 1;
+
+            struct ThreadRing
+            {
+                std::shared_ptr<TraceRing> ring;
+
+                ThreadRing()
+                {
+                    auto&                       registry = GetInstance();
+                    std::lock_guard<std::mutex> lock(registry.mutex_);
+                    ring = std::make_shared<TraceRing>(registry.nextThread_++);
+                    registry.rings_.push_back(ring);
+                }
+
+                ~ThreadRing() { ring->retire(); }
             };
 
-            template<typename... Layers>
-            struct EnabledLayerInfoImpl
-            {
-                static constexpr std::array<bool, sizeof...(Layers)> enabled = { LayerTraits<Layers>::compiletimeEnabled... };
-            };
+        public:
+            static TraceRegistry& GetInstance()
+            {
+                static TraceRegistry instance;
+                return instance;
+            }
+
+            static TraceRing& Local()
+            {
+                static thread_local ThreadRing local;
+                return *local.ring;
+            }
+
+            /// @brief Ring of the calling thread, nullptr while capture is off
+            static TraceRing* Active() { return TraceCapturing().load(std::memory_order_relaxed) ? &Local() : nullptr; }
+
+            template <typename Visit>
+            void forEach(Visit&& visit)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (const auto& ring : rings_)
+                    visit(*ring);
+            }
+
+            void clear()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const auto& ring) { return ring->retired(); }), rings_.end());
+                for (const auto& ring : rings_)
+                    ring->clear();
+            }
+        };
+
+        /// @brief Records a begin event now and the matching end event when destroyed
+        class TraceScope
+        {
+        private:
+            TraceRing*       ring_;
+            const TraceSite& site_;
+
+        public:
+            explicit TraceScope(const TraceSite& site) : ring_(TraceRegistry::Active()), site_(site)
+            {
+                if (ring_)
+                    ring_->record(site_, false);
+            }
+
+            ~TraceScope()
+            {
+                if (ring_)
+                    ring_->record(site_, true);
+            }
+
+            TraceScope(const TraceScope&)            = delete;
+            TraceScope& operator=(const TraceScope&) = delete;
+        };
+    }
+
+    template <typename... Layers>
+    struct Strata;
+
+    namespace util
+    {
+        struct ChromeTrace;
+    }
+
+    namespace detail
+    {
+        // Type list joined by a fold over operator+, so filtering a pack needs no recursion
+        template <typename... Layers>
+        struct LayerList
+        {
+            using strata = Strata<Layers...>;
+        };
+
+        template <typename... A, typename... B>
+        LayerList<A..., B...> operator+(LayerList<A...>, LayerList<B...>);
+
+        template <bool kKeep, typename Layer>
+        using KeepIf = std::conditional_t<kKeep, LayerList<Layer>, LayerList<>>;
+
+        template <typename... Lists>
+        using JoinLayers = typename decltype((LayerList<> {} + ... + Lists {}))::strata;
+
+        // Hook detection lives outside Strata so every stack, including the per-operation
+        // stacks Exec prunes to, shares one instantiation per layer and operation
+
+        // Layers may handle a whole batch with BeforeBatch/AfterBatch instead of per-call hooks
+        template <typename Layer, typename Op, typename = void>
+        struct has_before_batch : std::false_type
+        {};
+
+        template <typename Layer, typename Op>
+        struct has_before_batch<Layer, Op, std::void_t<decltype(Layer::template Impl<Op>::BeforeBatch(std::declval<Span<typename Op::BatchArguments>>()))>> : std::true_type
+        {};
+
+        template <typename Layer, typename Op, typename Results, typename = void>
+        struct has_after_batch : std::false_type
+        {};
+
+        template <typename Layer, typename Op>
+        struct has_after_batch<Layer, Op, detail::NoResults, std::void_t<decltype(Layer::template Impl<Op>::AfterBatch(std::declval<Span<typename Op::BatchArguments>>()))>> : std::true_type
+        {};
+
+        template <typename Layer, typename Op, typename ReturnT>
+        struct has_after_batch<Layer, Op, Span<ReturnT>, std::void_t<decltype(Layer::template Impl<Op>::AfterBatch(std::declval<Span<typename Op::BatchArguments>>(), std::declval<Span<ReturnT>>()))>> : std::true_type
+        {};
+
+        // A Before that returns a value hands it to After as the first argument,
+        // a ShortCircuit is kept as is and only forwards the token it continued with
+        template <typename Layer, typename Op, typename Arguments, typename = void>
+        struct before_token
+        {
+            using type = detail::NoToken;
+        };
+
+        template <typename Layer, typename Op, typename... Args>
+        struct before_token<Layer, Op, std::tuple<Args...>, std::enable_if_t<!std::is_void_v<decltype(Layer::template Impl<Op>::Before(std::declval<Args&>()...))>>>
+        {
+            using result = std::decay_t<decltype(Layer::template Impl<Op>::Before(std::declval<Args&>()...))>;
+            using type   = std::conditional_t<detail::is_short_circuit<result>::value, result, std::optional<result>>;
+        };
+
+        template <typename Layer, typename Op, typename... Args>
+        using before_token_t = typename before_token<Layer, Op, std::tuple<Args...>>::type;
+
+        // Layers may gate their hooks per call with `template <typename Op> static bool Active()`
+        template <typename Layer, typename Op, typename = void>
+        struct has_gate : std::false_type
+        {};
+
+        template <typename Layer, typename Op>
+        struct has_gate<Layer, Op, std::void_t<decltype(Layer::template Active<Op>())>> : std::true_type
+        {};
+
+        // SFINAE helpers to detect if a layer has an implementation for an operation
+        template <typename Layer, typename Op, typename = void>
+        struct has_specific_before_impl : std::false_type
+        {};
+
+        template <typename Layer, typename Op, typename = void>
+        struct has_specific_after_impl : std::false_type
+        {};
+
+        template <typename Layer, typename Op>
+        struct has_specific_before_impl<Layer, Op, std::void_t<decltype(Layer::template Impl<Op>::Before)>> : std::true_type
+        {};
+
+        template <typename Layer, typename Op>
+        struct has_specific_after_impl<Layer, Op, std::void_t<decltype(Layer::template Impl<Op>::After)>> : std::true_type
+        {};
+
+        template <typename Layer, typename... Args>
+        struct has_generic_before_impl
+        {
+            template <typename T>
+            static auto test(int) -> decltype(T::template Impl<void>::Before(std::declval<Args>()...), std::true_type {});
+
+            template <typename>
+            static auto test(...) -> std::false_type;
+
+            static constexpr bool value = decltype(test<Layer>(0))::value;
+        };
+
+        template <typename Layer, typename... Args>
+        struct has_generic_after_impl
+        {
+            template <typename T>
+            static auto test(int) -> decltype(T::template Impl<void>::After(std::declval<Args>()...), std::true_type {});
+
+            template <typename>
+            static auto test(...) -> std::false_type;
+
+            static constexpr bool value = decltype(test<Layer>(0))::value;
+        };
+
+        // A layer takes part in Op when it declares a hook for it or one accepts the call's arguments
+        template <typename Layer, typename Op, typename Arguments, typename = void>
+        struct accepts_before : std::false_type
+        {};
+
+        template <typename Layer, typename Op, typename... Args>
+        struct accepts_before<Layer, Op, std::tuple<Args...>, std::void_t<decltype(Layer::template Impl<Op>::Before(std::declval<Args&>()...))>> : std::true_type
+        {};
+
+        template <typename Layer, typename Op, typename Arguments, typename = void>
+        struct accepts_after : std::false_type
+        {};
+
+        template <typename Layer, typename Op, typename... Args>
+        struct accepts_after<Layer, Op, std::tuple<Args...>, std::void_t<decltype(Layer::template Impl<Op>::After(std::declval<Args&>()...))>> : std::true_type
+        {};
+
+        template <typename Layer, typename Op, typename Arguments, bool kBatch>
+        struct implements_op;
+
+        template <typename Layer, typename Op, typename... Args, bool kBatch>
+        struct implements_op<Layer, Op, std::tuple<Args...>, kBatch>
+        {
+            using ReturnT     = typename Op::ReturnType;
+            using AfterInputs = std::conditional_t<std::is_void_v<ReturnT>, std::tuple<Args...>, std::tuple<std::conditional_t<std::is_void_v<ReturnT>, int, ReturnT>, Args...>>;
+            using Results     = std::conditional_t<std::is_void_v<ReturnT>, detail::NoResults, Span<std::conditional_t<std::is_void_v<ReturnT>, int, ReturnT>>>;
+
+            static constexpr bool value = has_specific_before_impl<Layer, Op>::value || has_specific_after_impl<Layer, Op>::value
+                                       || accepts_before<Layer, Op, std::tuple<Args...>>::value || accepts_after<Layer, Op, AfterInputs>::value
+                                       || (kBatch && (has_before_batch<Layer, Op>::value || has_after_batch<Layer, Op, Results>::value));
+        };
+
+#if STRATA_HAS_COROUTINES
+        // Result type of a Before (or After) call with the given arguments, void when absent
+        template <typename Layer, typename Op, bool kBefore, typename Arguments, typename = void>
+        struct hook_result
+        {
+            using type = void;
+        };
+
+        template <typename Layer, typename Op, typename... Args>
+        struct hook_result<Layer, Op, true, std::tuple<Args...>, std::void_t<decltype(Layer::template Impl<Op>::Before(std::declval<Args>()...))>>
+        {
+            using type = decltype(Layer::template Impl<Op>::Before(std::declval<Args>()...));
+        };
+
+        template <typename Layer, typename Op, typename... Args>
+        struct hook_result<Layer, Op, false, std::tuple<Args...>, std::void_t<decltype(Layer::template Impl<Op>::After(std::declval<Args>()...))>>
+        {
+            using type = decltype(Layer::template Impl<Op>::After(std::declval<Args>()...));
+        };
+
+        template <typename Token, typename... Args>
+        struct after_arguments
+        {
+            template <bool kPassed = detail::hook_token<Token>::kPassed, typename = void>
+            struct select
+            {
+                using type = std::tuple<Args&...>;
+            };
+
+            template <typename Unused>
+            struct select<true, Unused>
+            {
+                using type = std::tuple<typename detail::hook_token<Token>::value_type&, Args&...>;
+            };
+
+            using type = typename select<>::type;
+        };
+
+        // Awaitable Before hooks yield their awaited result as the token
+        template <typename Layer, typename Op, typename... Args>
+        struct async_token
+        {
+            using result = typename hook_result<Layer, Op, true, std::tuple<Args&...>>::type;
+
+            template <typename Result, bool = detail::is_awaiter<Result>::value>
+            struct awaited
+            {
+                using type = before_token_t<Layer, Op, Args...>;
+            };
+
+            template <typename Result>
+            struct awaited<Result, true>
+            {
+                using value = std::decay_t<decltype(std::declval<Result&>().await_resume())>;
+                static_assert(!detail::is_short_circuit<value>::value, "Only synchronous Before hooks can short-circuit");
+
+                using type = std::conditional_t<std::is_void_v<value>, detail::NoToken, std::optional<std::conditional_t<std::is_void_v<value>, int, value>>>;
+            };
+
+            using type = typename awaited<result>::type;
+        };
+
+        template <typename Layer, typename Op, typename... Args>
+        using async_token_t = typename async_token<Layer, Op, Args...>::type;
+#endif
+    }
+
+    /// @brief Main layer composition template
+    ///
+    /// Combines multiple layers into a processing pipeline where each layer can
+    /// intercept operations before and after execution.
+    template <typename... Layers>
+    struct Strata
+    {
+        /// @brief Executes an operation through all enabled layers
+        ///
+        /// @tparam Op Operation type that defines return type and arguments
+        /// @tparam Func Signature of the function to execute
+        /// @tparam Args Types of the arguments
+        ///
+        /// @param func Core function to wrap in layers
+        /// @param args Arguments to pass through layers to the function
+        /// @return ReturnT Result of the operation
+        ///
+        /// Hooks receive the arguments as lvalues, so they may take `const T&` views or
+        /// `T&` to modify them, but never move from them. Only the core function receives
+        /// the forwarded arguments, and After observes them as the core left them.
+        /// Layers without a hook for Op are pruned first and never instantiated for it.
+        template <typename Op, typename Func, typename... Args>
+        static typename Op::ReturnType Exec(Func&& func, Args&&... args)
+        {
+            static_assert(Op::template validates_function<Func>,
+                "Function signature does not match operation definition");
+
+            using Pruned = typename op_layers<Op, std::tuple<Args...>, false>::type;
+
+            #define CORE_FUNC() std::forward<Func>(func)(std::forward<Args>(args)...)
+            {
+                if constexpr (sizeof...(Layers) == 0)
+                {
+                    if constexpr (std::is_void_v<typename Op::ReturnType>)
+                        CORE_FUNC();
+                    else
+                        return CORE_FUNC();
+                }
+                else if constexpr (!std::is_same_v<Pruned, Strata>)
+                {
+                    return Pruned::template Exec<Op>(std::forward<Func>(func), std::forward<Args>(args)...);
+                }
+                else
+                {
+                    [[maybe_unused]] ScratchScope<Op> scratch;
+
+                    // Gates are evaluated once so Before and After agree for this call
+                    constexpr bool      kAnyToggleable = (detail::runtime_toggle<detail::hook_layer_t<Layers>>::value || ...);
+                    const std::uint64_t runtimeMask    = kAnyToggleable ? detail::RuntimeLayerMask().load(std::memory_order_relaxed) : 0;
+
+                    const std::array<bool, sizeof...(Layers)> active = { IsLayerActive<Op, Layers>(runtimeMask)... };
+
+                    // Tokens returned by Before live on this frame until the matching After
+                    using Tokens = std::tuple<detail::before_token_t<detail::hook_layer_t<Layers>, Op, Args...>...>;
+                    Tokens tokens;
+
+                    if constexpr (kShortCircuits<Tokens>)
+                    {
+                        const std::size_t depth = ApplyBeforeUntil<Op>(active, tokens, std::false_type {}, std::index_sequence_for<Layers...> {}, args...);
+                        if (depth < sizeof...(Layers))
+                            return FinishShortCircuit<Op>(active, tokens, depth, std::false_type {}, args...);
+                    }
+                    else
+                    {
+                        ApplyBeforeEach<Op>(active, tokens, std::false_type {}, std::index_sequence_for<Layers...> {}, args...);
+                    }
+
+                    if constexpr (std::is_void_v<typename Op::ReturnType>)
+                    {
+                        CORE_FUNC();
+                        ApplyAfterEach<Op>(active, tokens, std::false_type {}, std::index_sequence_for<Layers...> {}, args...);
+                    }
+                    else
+                    {
+                        typename Op::ReturnType result = CORE_FUNC();
+                        ApplyAfterEach<Op>(active, tokens, std::false_type {}, std::index_sequence_for<Layers...> {}, result, args...);
+                        return result;
+                    }
+                }
+            }
+            #undef CORE_FUNC
+        }
+
+        /// @brief Executes an operation over a batch of inputs through all enabled layers
+        ///
+        /// Layers may provide `static void BeforeBatch(Span<typename Op::BatchArguments>)` and
+        /// `static void AfterBatch(Span<typename Op::BatchArguments>, Span<ReturnT>)` to handle the
+        /// whole batch at once. Batch hooks run around the entire batch, while per-call hooks of
+        /// the remaining layers run around each element. Gates are evaluated once per batch.
+        ///
+        /// @param func Core function, called once per element
+        /// @param inputs Argument tuples, passed to the hooks and the core as lvalues
+        /// @param results Receives the result of each element, at least as large as inputs
+        template <typename Op, typename Func, typename = std::enable_if_t<!std::is_void_v<typename Op::ReturnType>>>
+        static void ExecBatch(Func&& func, Span<typename Op::BatchArguments> inputs, Span<typename Op::ReturnType> results)
+        {
+            if (results.size() < inputs.size())
+                throw std::invalid_argument("ExecBatch results span is smaller than its inputs");
+
+            detail::InlineExecutor executor;
+            ExecBatchImpl<Op>(executor, func, inputs, results);
+        }
+
+        /// @brief Executes a void operation over a batch of inputs, see ExecBatch above
+        template <typename Op, typename Func, typename = std::enable_if_t<std::is_void_v<typename Op::ReturnType>>>
+        static void ExecBatch(Func&& func, Span<typename Op::BatchArguments> inputs)
+        {
+            detail::InlineExecutor executor;
+            ExecBatchImpl<Op>(executor, func, inputs, detail::NoResults {});
+        }
+
+        /// @brief Executes a batch in parallel, splitting the inputs into ranges across an executor
+        ///
+        /// The executor is any type providing `ParallelFor(std::size_t count, Task task)` that calls
+        /// `task(begin, end)` for disjoint ranges covering [0, count) and returns once all have run,
+        /// such as util::WorkStealingPool or util::PolicyExecutor. Batch hooks run on the calling
+        /// thread. Per-call hooks run on the workers, serialized per layer unless its
+        /// LayerConcurrencyTraits declare `threadSafe`. The first exception thrown by any element is rethrown here.
+        template <typename Op, typename Executor, typename Func, typename = std::enable_if_t<!std::is_void_v<typename Op::ReturnType>>>
+        static void ExecBatch(Executor& executor, Func&& func, Span<typename Op::BatchArguments> inputs, Span<typename Op::ReturnType> results)
+        {
+            if (results.size() < inputs.size())
+                throw std::invalid_argument("ExecBatch results span is smaller than its inputs");
+
+            ExecBatchImpl<Op>(executor, func, inputs, results);
+        }
+
+        /// @brief Executes a void operation over a batch in parallel, see ExecBatch above
+        template <typename Op, typename Executor, typename Func, typename = std::enable_if_t<std::is_void_v<typename Op::ReturnType>>>
+        static void ExecBatch(Executor& executor, Func&& func, Span<typename Op::BatchArguments> inputs)
+        {
+            ExecBatchImpl<Op>(executor, func, inputs, detail::NoResults {});
+        }
+
+#if STRATA_HAS_COROUTINES
+        /// @brief Executes an asynchronous operation through all enabled layers
+        ///
+        /// The core function returns an awaitable producing Op::ReturnType, and After runs once
+        /// it has completed. Hooks may be plain functions or return awaiters, which are awaited
+        /// in place; an awaiter's result becomes the token handed to After. Arguments are stored
+        /// in the coroutine frame, the core receives them as rvalues.
+        ///
+        /// @return Task<ReturnT> Lazily started task, await it or pass it to SyncWait
+        template <typename Op, typename Func, typename... Args>
+        static Task<typename Op::ReturnType> ExecAsync(Func&& func, Args&&... args)
+        {
+            using Pruned = typename op_layers<Op, std::tuple<std::decay_t<Args>...>, false>::type;
+
+            if constexpr (!std::is_same_v<Pruned, Strata>)
+                return Pruned::template ExecAsync<Op>(std::forward<Func>(func), std::forward<Args>(args)...);
+            else
+                return ExecAsyncImpl<Op>(std::index_sequence_for<Layers...> {}, std::forward<Func>(func), std::forward<Args>(args)...);
+        }
+#endif
+
+        // Helper to add new layers to the front
+        template <typename NewLayer>
+        using PrependLayer = Strata<NewLayer, Layers...>;
+
+        /// @brief Layer names in application order, built once per instantiation at compile time
+        static constexpr std::array<std::string_view, sizeof...(Layers)> LayerNames = { detail::TypeName<Layers>()... };
+
+        /// @brief Name of an operation executed through this stratum
+        template <typename Op>
+        static constexpr std::string_view OpName = detail::TypeName<Op>();
+
+    private:
+        template <typename Op>
+        using ScratchScope = std::conditional_t<(detail::uses_scratch<detail::hook_layer_t<Layers>>::value || ...), typename ScratchArena<Op>::Scope, detail::NoToken>;
+
+        template <typename Op, typename Layer>
+        static bool IsLayerActive([[maybe_unused]] std::uint64_t runtimeMask)
+        {
+            if constexpr (detail::runtime_toggle<detail::hook_layer_t<Layer>>::value)
+            {
+                if (!(runtimeMask & detail::RuntimeLayerBit<detail::hook_layer_t<Layer>>()))
+                    return false;
+            }
+
+            if constexpr (detail::has_gate<Layer, Op>::value)
+                return Layer::template Active<Op>();
+            else
+                return true;
+        }
+
+        // Parallel batches hold a per-layer lock around hooks of layers not declared thread-safe
+        template <typename Layer, bool kSerialize>
+        static auto LockHooks(std::bool_constant<kSerialize>)
+        {
+            if constexpr (kSerialize && !detail::thread_safe_hooks<Layer>::value)
+                return std::unique_lock<std::mutex>(detail::LayerHookMutex<Layer>());
+            else
+                return detail::NoToken {};
+        }
+
+        template <typename Op, typename Tokens, typename Serialize, std::size_t... I, typename... Args>
+        static void ApplyBeforeEach(const std::array<bool, sizeof...(Layers)>& active, Tokens& tokens, Serialize serialize, std::index_sequence<I...>, Args&... args)
+        {
+            ((active[I] ? ApplyBeforeIfExists<Op, detail::hook_layer_t<Layers>>(std::get<I>(tokens), serialize, args...) : void()), ...);
+        }
+
+        static constexpr bool kTracing = (std::is_same_v<detail::hook_layer_t<Layers>, util::ChromeTrace> || ...);
+
+        // With util::ChromeTrace in the stack each hook that exists records a span under its
+        // layer's name, LayerTraits::traceHooks overrides this per layer
+        template <typename Op, typename Layer, bool kBefore, bool kExists>
+        static auto TraceHook()
+        {
+            if constexpr (kExists && !std::is_same_v<Layer, util::ChromeTrace> && detail::trace_hooks<Layer, kTracing>::value)
+                return detail::TraceScope(detail::kHookTraceSite<Layer, Op, kBefore>);
+            else
+                return detail::NoToken {};
+        }
+
+        template <typename Op, typename Layer, typename Token, typename Serialize, typename... Args>
+        static void ApplyBeforeIfExists(Token& token, Serialize serialize, Args&... args)
+        {
+            [[maybe_unused]] auto lock  = LockHooks<Layer>(serialize);
+            [[maybe_unused]] auto trace = TraceHook<Op, Layer, true,
+                !std::is_same_v<Token, detail::NoToken> || detail::has_specific_before_impl<Layer, Op>::value || detail::has_generic_before_impl<Layer, Args&...>::value>();
+
+            if constexpr (std::is_same_v<Token, detail::NoToken>)
+            {
+                if constexpr (detail::has_specific_before_impl<Layer, Op>::value)
+                    Layer::template Impl<Op>::Before(args...);
+                else if constexpr (detail::has_generic_before_impl<Layer, Args&...>::value)
+                    Layer::template Impl<Op>::Before(args...);
+            }
+            else if constexpr (detail::is_short_circuit<Token>::value)
+            {
+                token = Layer::template Impl<Op>::Before(args...);
+            }
+            else
+            {
+                token.emplace(Layer::template Impl<Op>::Before(args...));
+            }
+        }
+
+        template <typename Tokens, std::size_t... I>
+        static constexpr bool AnyShortCircuit(std::index_sequence<I...>)
+        {
+            return (detail::is_short_circuit<std::tuple_element_t<I, Tokens>>::value || ...);
+        }
+
+        // Stacks without a short-circuiting Before keep the unconditional hook sequence
+        template <typename Tokens>
+        static constexpr bool kShortCircuits = AnyShortCircuit<Tokens>(std::index_sequence_for<Layers...> {});
+
+        // Runs Before hooks outside in until one short-circuits, returns its index or the layer count
+        template <typename Op, typename Tokens, typename Serialize, std::size_t... I, typename... Args>
+        static std::size_t ApplyBeforeUntil(const std::array<bool, sizeof...(Layers)>& active, Tokens& tokens, Serialize serialize, std::index_sequence<I...>, Args&... args)
+        {
+            std::size_t depth = sizeof...(Layers);
+            (void)((((active[I] ? ApplyBeforeIfExists<Op, detail::hook_layer_t<Layers>>(std::get<I>(tokens), serialize, args...) : void()),
+                     !detail::Tripped(std::get<I>(tokens)) || (depth = I, false)) && ...));
+            return depth;
+        }
+
+        // Unwinds the layers outside the short-circuiting one with its value as the result
+        template <typename Op, typename Tokens, typename Serialize, typename... Args>
+        static typename Op::ReturnType FinishShortCircuit(const std::array<bool, sizeof...(Layers)>& active, Tokens& tokens, std::size_t depth, Serialize serialize, Args&... args)
+        {
+            const auto outer = OuterLayers(active, depth, std::index_sequence_for<Layers...> {});
+
+            if constexpr (std::is_void_v<typename Op::ReturnType>)
+            {
+                ApplyAfterEach<Op>(outer, tokens, serialize, std::index_sequence_for<Layers...> {}, args...);
+            }
+            else
+            {
+                typename Op::ReturnType result = TakeShortCircuit<typename Op::ReturnType>(tokens, depth, std::index_sequence_for<Layers...> {});
+                ApplyAfterEach<Op>(outer, tokens, serialize, std::index_sequence_for<Layers...> {}, result, args...);
+                return result;
+            }
+        }
+
+        template <std::size_t... I>
+        static std::array<bool, sizeof...(Layers)> OuterLayers(const std::array<bool, sizeof...(Layers)>& active, std::size_t depth, std::index_sequence<I...>)
+        {
+            return { (active[I] && I < depth)... };
+        }
+
+        template <typename ReturnT, typename Tokens, std::size_t... I>
+        static ReturnT TakeShortCircuit(Tokens& tokens, std::size_t depth, std::index_sequence<I...>)
+        {
+            std::optional<ReturnT> result;
+            ((I == depth ? TakeShortCircuitAt(std::get<I>(tokens), result) : void()), ...);
+            return std::move(*result);
+        }
+
+        template <typename Token, typename ReturnT>
+        static void TakeShortCircuitAt([[maybe_unused]] Token& token, [[maybe_unused]] std::optional<ReturnT>& result)
+        {
+            if constexpr (detail::is_short_circuit<Token>::value)
+            {
+                static_assert(std::is_constructible_v<ReturnT, typename Token::Value&&>, "ShortCircuit value does not convert to the operation result");
+                result.emplace(std::move(token.value()));
+            }
+        }
+
+        // After runs innermost first to wrap the function symmetrically, the arguments
+        // begin with the result for value-returning operations
+        template <typename Op, typename Tokens, typename Serialize, std::size_t... I, typename... Args>
+        static void ApplyAfterEach(const std::array<bool, sizeof...(Layers)>& active, Tokens& tokens, Serialize serialize, std::index_sequence<I...>, Args&... args)
+        {
+            constexpr std::size_t kLast = sizeof...(Layers) - 1;
+            ((active[kLast - I] ? ApplyAfter<Op, detail::hook_layer_t<std::tuple_element_t<kLast - I, std::tuple<Layers...>>>>(std::get<kLast - I>(tokens), serialize, args...) : void()), ...);
+        }
+
+        template <typename Op, typename Layer, typename Token, typename Serialize, typename... Args>
+        static void ApplyAfter(Token& token, Serialize serialize, Args&... args)
+        {
+            [[maybe_unused]] auto trace = TraceHook<Op, Layer, false,
+                detail::hook_token<Token>::kPassed || detail::has_specific_after_impl<Layer, Op>::value || detail::has_generic_after_impl<Layer, Args&...>::value>();
+
+            if constexpr (detail::defer_after<Layer>::value)
+            {
+                if (DeferAfter<Op, Layer>(token, args...))
+                    return;
+            }
+
+            [[maybe_unused]] auto lock = LockHooks<Layer>(serialize);
+
+            if constexpr (!detail::hook_token<Token>::kPassed)
+            {
+                if constexpr (detail::has_specific_after_impl<Layer, Op>::value)
+                    Layer::template Impl<Op>::After(args...);
+                else if constexpr (detail::has_generic_after_impl<Layer, Args&...>::value)
+                    Layer::template Impl<Op>::After(args...);
+            }
+            else if (detail::hook_token<Token>::Has(token))
+            {
+                Layer::template Impl<Op>::After(detail::hook_token<Token>::Get(token), args...);
+            }
+        }
+
+        // Snapshots the hook arguments into the deferred queue, false if the hook must run inline
+        template <typename Op, typename Layer, typename Token, typename... Args>
+        static bool DeferAfter(Token& token, Args&... args)
+        {
+            if constexpr (!std::conjunction_v<DeferrableArgument<std::decay_t<Args>>...>)
+            {
+                return false;
+            }
+            else if constexpr (!detail::hook_token<Token>::kPassed)
+            {
+                if constexpr (detail::has_specific_after_impl<Layer, Op>::value || detail::has_generic_after_impl<Layer, Args&...>::value)
+                {
+                    return DeferredAfterQueue::GetInstance().tryPush([snapshot = std::tuple<std::decay_t<Args>...>(args...)]() mutable {
+                        std::apply([](auto&... values) { Layer::template Impl<Op>::After(values...); }, snapshot);
+                    });
+                }
+                else
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                if constexpr (!DeferrableArgument<typename detail::hook_token<Token>::value_type>::value)
+                {
+                    return false;
+                }
+                else
+                {
+                    if (!detail::hook_token<Token>::Has(token))
+                        return true;
+
+                    using Snapshot = std::tuple<typename detail::hook_token<Token>::value_type, std::decay_t<Args>...>;
+                    return DeferredAfterQueue::GetInstance().tryPush([snapshot = Snapshot(detail::hook_token<Token>::Get(token), args...)]() mutable {
+                        std::apply([](auto&... values) { Layer::template Impl<Op>::After(values...); }, snapshot);
+                    });
+                }
+            }
+        }
+
+        template <typename Op, typename Executor, typename Func, typename Results>
+        static void ExecBatchImpl(Executor& executor, Func& func, Span<typename Op::BatchArguments> inputs, Results results)
+        {
+            static_assert(Op::template validates_function<Func>,
+                "Function signature does not match operation definition");
+
+            constexpr bool kVoid = std::is_same_v<Results, detail::NoResults>;
+
+            using Pruned = typename op_layers<Op, typename Op::BatchArguments, true>::type;
+
+            if constexpr (sizeof...(Layers) > 0 && !std::is_same_v<Pruned, Strata>)
+            {
+                if constexpr (kVoid)
+                    Pruned::template ExecBatch<Op>(executor, func, inputs);
+                else
+                    Pruned::template ExecBatch<Op>(executor, func, inputs, results);
+            }
+            else if constexpr (sizeof...(Layers) == 0)
+            {
+                executor.ParallelFor(inputs.size(), [&](std::size_t begin, std::size_t end) {
+                    for (std::size_t i = begin; i < end; ++i)
+                    {
+                        if constexpr (kVoid)
+                            std::apply(func, inputs[i]);
+                        else
+                            results[i] = std::apply(func, inputs[i]);
+                    }
+                });
+            }
+            else
+            {
+                using Active    = std::array<bool, sizeof...(Layers)>;
+                using Serialize = std::bool_constant<!std::is_same_v<Executor, detail::InlineExecutor>>;
+
+                constexpr bool      kAnyToggleable = (detail::runtime_toggle<detail::hook_layer_t<Layers>>::value || ...);
+                const std::uint64_t runtimeMask    = kAnyToggleable ? detail::RuntimeLayerMask().load(std::memory_order_relaxed) : 0;
+
+                // Batch hooks replace the per-element hook of the same phase
+                constexpr Active kBatchBefore = { detail::has_before_batch<detail::hook_layer_t<Layers>, Op>::value... };
+                constexpr Active kBatchAfter  = { detail::has_after_batch<detail::hook_layer_t<Layers>, Op, Results>::value... };
+
+                const Active active        = { IsLayerActive<Op, Layers>(runtimeMask)... };
+                const Active elementBefore = MaskLayers(active, kBatchBefore, std::index_sequence_for<Layers...> {});
+                const Active elementAfter  = MaskLayers(active, kBatchAfter, std::index_sequence_for<Layers...> {});
+
+                // Batch hooks and each element get their own scratch scope, so memory never piles up across a batch
+                {
+                    [[maybe_unused]] ScratchScope<Op> scratch;
+                    ApplyBeforeBatchEach<Op>(active, std::index_sequence_for<Layers...> {}, inputs);
+                }
+
+                executor.ParallelFor(inputs.size(), [&](std::size_t begin, std::size_t end) {
+                    for (std::size_t i = begin; i < end; ++i)
+                    {
+                        [[maybe_unused]] ScratchScope<Op> scratch;
+                        std::apply([&](auto&... args) {
+                            using Tokens = std::tuple<detail::before_token_t<detail::hook_layer_t<Layers>, Op, decltype(args)...>...>;
+                            Tokens tokens;
+
+                            if constexpr (kShortCircuits<Tokens>)
+                            {
+                                const std::size_t depth = ApplyBeforeUntil<Op>(elementBefore, tokens, Serialize {}, std::index_sequence_for<Layers...> {}, args...);
+                                if (depth < sizeof...(Layers))
+                                {
+                                    if constexpr (kVoid)
+                                        FinishShortCircuit<Op>(elementAfter, tokens, depth, Serialize {}, args...);
+                                    else
+                                        results[i] = FinishShortCircuit<Op>(elementAfter, tokens, depth, Serialize {}, args...);
+                                    return;
+                                }
+                            }
+                            else
+                            {
+                                ApplyBeforeEach<Op>(elementBefore, tokens, Serialize {}, std::index_sequence_for<Layers...> {}, args...);
+                            }
+
+                            if constexpr (kVoid)
+                            {
+                                func(args...);
+                                ApplyAfterEach<Op>(elementAfter, tokens, Serialize {}, std::index_sequence_for<Layers...> {}, args...);
+                            }
+                            else
+                            {
+                                results[i] = func(args...);
+                                ApplyAfterEach<Op>(elementAfter, tokens, Serialize {}, std::index_sequence_for<Layers...> {}, results[i], args...);
+                            }
+                        }, inputs[i]);
+                    }
+                });
+
+                [[maybe_unused]] ScratchScope<Op> scratch;
+                ApplyAfterBatchEach<Op>(active, std::index_sequence_for<Layers...> {}, inputs, results);
+            }
+        }
+
+        template <std::size_t... I>
+        static constexpr std::array<bool, sizeof...(Layers)> MaskLayers(const std::array<bool, sizeof...(Layers)>& active, const std::array<bool, sizeof...(Layers)>& excluded, std::index_sequence<I...>)
+        {
+            return { (active[I] && !excluded[I])... };
+        }
+
+        template <typename Op, std::size_t... I>
+        static void ApplyBeforeBatchEach(const std::array<bool, sizeof...(Layers)>& active, std::index_sequence<I...>, Span<typename Op::BatchArguments> inputs)
+        {
+            ((active[I] ? ApplyBeforeBatch<Op, detail::hook_layer_t<Layers>>(inputs) : void()), ...);
+        }
+
+        template <typename Op, std::size_t... I, typename Results>
+        static void ApplyAfterBatchEach(const std::array<bool, sizeof...(Layers)>& active, std::index_sequence<I...>, Span<typename Op::BatchArguments> inputs, Results results)
+        {
+            // Innermost layer first, matching Exec
+            constexpr std::size_t kLast = sizeof...(Layers) - 1;
+            ((active[kLast - I] ? ApplyAfterBatch<Op, detail::hook_layer_t<std::tuple_element_t<kLast - I, std::tuple<Layers...>>>>(inputs, results) : void()), ...);
+        }
+
+        template <typename Op, typename Layer>
+        static void ApplyBeforeBatch([[maybe_unused]] Span<typename Op::BatchArguments> inputs)
+        {
+            if constexpr (detail::has_before_batch<Layer, Op>::value)
+                Layer::template Impl<Op>::BeforeBatch(inputs);
+        }
+
+        template <typename Op, typename Layer, typename Results>
+        static void ApplyAfterBatch([[maybe_unused]] Span<typename Op::BatchArguments> inputs, [[maybe_unused]] Results results)
+        {
+            if constexpr (detail::has_after_batch<Layer, Op, Results>::value)
+            {
+                if constexpr (std::is_same_v<Results, detail::NoResults>)
+                    Layer::template Impl<Op>::AfterBatch(inputs);
+                else
+                    Layer::template Impl<Op>::AfterBatch(inputs, results);
+            }
+        }
+
+
+#if STRATA_HAS_COROUTINES
+        template <typename Op, std::size_t... I, typename Func, typename... Args>
+        static Task<typename Op::ReturnType> ExecAsyncImpl(std::index_sequence<I...>, Func func, Args... args)
+        {
+            using ReturnT = typename Op::ReturnType;
+
+            if constexpr (sizeof...(Layers) == 0)
+            {
+                co_return co_await std::move(func)(std::move(args)...);
+            }
+            else
+            {
+                constexpr bool      kAnyToggleable = (detail::runtime_toggle<detail::hook_layer_t<Layers>>::value || ...);
+                const std::uint64_t runtimeMask    = kAnyToggleable ? detail::RuntimeLayerMask().load(std::memory_order_relaxed) : 0;
+
+                const std::array<bool, sizeof...(Layers)> active = { IsLayerActive<Op, Layers>(runtimeMask)... };
+
+                using Tokens = std::tuple<detail::async_token_t<detail::hook_layer_t<Layers>, Op, Args...>...>;
+                Tokens tokens;
+
+                constexpr std::size_t kLast = sizeof...(Layers) - 1;
+                if constexpr (kShortCircuits<Tokens>)
+                {
+                    std::size_t depth = sizeof...(Layers);
+                    // Conditionals rather than an && fold, which GCC's coroutine lowering reports as an unused value
+                    ((depth == sizeof...(Layers)
+                          ? ((void)co_await ApplyBeforeAsync<Op, detail::hook_layer_t<Layers>>(active[I], std::get<I>(tokens), args...),
+                                (detail::Tripped(std::get<I>(tokens)) ? void(depth = I) : void()))
+                          : void()),
+                        ...);
+
+                    if (depth < sizeof...(Layers))
+                    {
+                        const auto outer = OuterLayers(active, depth, std::index_sequence_for<Layers...> {});
+                        if constexpr (std::is_void_v<ReturnT>)
+                        {
+                            (co_await ApplyAfterAsync<Op, detail::hook_layer_t<std::tuple_element_t<kLast - I, std::tuple<Layers...>>>>(outer[kLast - I], std::get<kLast - I>(tokens), args...), ...);
+                            co_return;
+                        }
+                        else
+                        {
+                            ReturnT result = TakeShortCircuit<ReturnT>(tokens, depth, std::index_sequence_for<Layers...> {});
+                            (co_await ApplyAfterAsync<Op, detail::hook_layer_t<std::tuple_element_t<kLast - I, std::tuple<Layers...>>>>(outer[kLast - I], std::get<kLast - I>(tokens), result, args...), ...);
+                            co_return result;
+                        }
+                    }
+                }
+                else
+                {
+                    (co_await ApplyBeforeAsync<Op, detail::hook_layer_t<Layers>>(active[I], std::get<I>(tokens), args...), ...);
+                }
+
+                if constexpr (std::is_void_v<ReturnT>)
+                {
+                    co_await std::move(func)(std::move(args)...);
+                    (co_await ApplyAfterAsync<Op, detail::hook_layer_t<std::tuple_element_t<kLast - I, std::tuple<Layers...>>>>(active[kLast - I], std::get<kLast - I>(tokens), args...), ...);
+                }
+                else
+                {
+                    ReturnT result = co_await std::move(func)(std::move(args)...);
+                    (co_await ApplyAfterAsync<Op, detail::hook_layer_t<std::tuple_element_t<kLast - I, std::tuple<Layers...>>>>(active[kLast - I], std::get<kLast - I>(tokens), result, args...), ...);
+                    co_return result;
+                }
+            }
+        }
+
+        template <typename Op, typename Layer, typename Token, typename... Args>
+        static auto ApplyBeforeAsync(bool active, Token& token, Args&... args)
+        {
+            using Result = typename detail::hook_result<Layer, Op, true, std::tuple<Args&...>>::type;
+
+            if constexpr (detail::is_awaiter<Result>::value)
+            {
+                detail::HookAwaiter<Result, Token> awaiter;
+                awaiter.token = &token;
+                if (active)
+                    awaiter.awaiter.emplace(Layer::template Impl<Op>::Before(args...));
+                return awaiter;
+            }
+            else
+            {
+                if (active)
+                    ApplyBeforeIfExists<Op, Layer>(token, std::false_type {}, args...);
+                return std::suspend_never {};
+            }
+        }
+
+        template <typename Op, typename Layer, typename Token, typename... Args>
+        static auto ApplyAfterAsync(bool active, Token& token, Args&... args)
+        {
+            using Result = typename detail::hook_result<Layer, Op, false, typename detail::after_arguments<Token, Args...>::type>::type;
+
+            if constexpr (detail::is_awaiter<Result>::value)
+            {
+                detail::HookAwaiter<Result, detail::NoToken> awaiter;
+                if constexpr (!detail::hook_token<Token>::kPassed)
+                {
+                    if (active)
+                        awaiter.awaiter.emplace(Layer::template Impl<Op>::After(args...));
+                }
+                else
+                {
+                    if (active && detail::hook_token<Token>::Has(token))
+                        awaiter.awaiter.emplace(Layer::template Impl<Op>::After(detail::hook_token<Token>::Get(token), args...));
+                }
+                return awaiter;
+            }
+            else
+            {
+                if (active)
+                    ApplyAfter<Op, Layer>(token, std::false_type {}, args...);
+                return std::suspend_never {};
+            }
+        }
+
+#endif
+
+        template <typename Op, typename Arguments, bool kBatch>
+        struct op_layers
+        {
+            using type = detail::JoinLayers<detail::KeepIf<detail::implements_op<detail::hook_layer_t<Layers>, Op, Arguments, kBatch>::value, Layers>...>;
+        };
+
+    public:
+        /// @brief The layers of this stack that implement Op, in order
+        ///
+        /// Exec, ExecBatch and ExecAsync run through this stack, so a layer without any
+        /// hook for Op adds neither gate checks nor hook instantiations to its calls.
+        template <typename Op>
+        using ForOp = typename op_layers<Op, typename Op::Arguments, false>::type;
+    };
+
+    /// @brief Non-inline entry point for one stack and operation, the unit of explicit instantiation
+    ///
+    /// Call() takes the core as `Op::Function` and the arguments as the operation declares them.
+    /// Declare STRATA_EXTERN_INSTANTIATION(Stack, Op) in a shared header and place
+    /// STRATA_INSTANTIATE(Stack, Op) in one source file; other translation units then call
+    /// the single compiled copy instead of instantiating the whole stack themselves.
+    template <typename Stack, typename Op, typename Arguments = typename Op::Arguments>
+    struct Dispatch;
+
+    template <typename Stack, typename Op, typename... Args>
+    struct Dispatch<Stack, Op, std::tuple<Args...>>
+    {
+        static typename Op::ReturnType Call(typename Op::Function func, Args... args);
+    };
+
+    // Defined out of class so extern declarations also suppress instantiation for inlining
+    template <typename Stack, typename Op, typename... Args>
+    typename Op::ReturnType Dispatch<Stack, Op, std::tuple<Args...>>::Call(typename Op::Function func, Args... args)
+    {
+        return Stack::template Exec<Op>(func, std::forward<Args>(args)...);
+    }
+
+    // Stack must be a single token, use an alias for stacks with several layers
+    #define STRATA_EXTERN_INSTANTIATION(Stack, Op) extern template struct strata::Dispatch<Stack, Op>
+    #define STRATA_INSTANTIATE(Stack, Op) template struct strata::Dispatch<Stack, Op>
+
+    ////////////////////////////////////////
+    // Utilities
+    ////////////////////////////////////////
+
+    namespace util
+    {
+        /// @brief Define a template alias for all available layers
+        template<typename... Layers>
+        using LayerPack = std::tuple<Layers...>;
+
+        /// @brief Helper to inspect enabled layers
+        template <typename LayerPackType>
+        struct EnabledLayerInfo
+        {
+            static constexpr auto enabled = detail::LayerPackHelper<LayerPackType>::template Apply<detail::EnabledLayerInfoImpl>::enabled;
+        };
+
+        /// @brief Check if a single layer is enabled
+        template<typename Layer>
+        inline constexpr bool IsLayerEnabled = LayerTraits<Layer>::compiletimeEnabled;
+
+        /// @brief Count enabled layers
+        template<typename LayerPackType>
+        constexpr size_t CountEnabledLayers = detail::LayerPackHelper<LayerPackType>::template ApplyValue<detail::CountEnabledLayersImpl>;
+
+        /// @brief Check if any layers are enabled
+        template<typename LayerPackType>
+        inline constexpr bool AnyLayersEnabled = detail::LayerPackHelper<LayerPackType>::template ApplyValue<detail::AnyLayersEnabledImpl>;
+
+        // Forward declaration
+        namespace detail { template <typename... Layers> struct LayerFilterImpl; }
+
+        // LayerFilter with SFINAE to handle both LayerPack and individual layers
+        /// @brief Provides Strata<Layers...> type with only enabled layers
+        /// Can be used to call Exec<Op>(func, args...)
+        /// Any <Layers...> with compiletimeEnabled = false are filtered out
+        /// The rest are ordered by their LayerTraits priority, highest outermost
+        template <typename... Layers>
+        using LayerFilter = typename detail::LayerFilterImpl<Layers...>::type;
+
+        namespace detail
+        {
+            // Helper to work with LayerPack
+            template<typename T>
+            struct LayerPackHelper;
+
+
+            template<typename... Layers>
+            struct LayerPackHelper<LayerPack<Layers...>>
+            {
+                template<template<typename...> class F>
+                using Apply = F<Layers...>;
+
+                template<template<typename...> class F>
+                static constexpr auto ApplyValue = F<Layers...>::value;
+            };
+
+
+            // Type trait to check if a type is a LayerPack
+            template<typename T>
+            struct is_layer_pack : std::false_type {};
+
+            template<typename... Layers>
+            struct is_layer_pack<LayerPack<Layers...>> : std::true_type {};
+
+            // Layers without a declared priority sit at 0, higher priorities run further out
+            template <typename Layer, typename = void>
+            struct layer_priority : std::integral_constant<int, 0>
+            {};
+
+            template <typename Layer>
+            struct layer_priority<Layer, std::void_t<decltype(LayerTraits<Layer>::priority)>> : std::integral_constant<int, LayerTraits<Layer>::priority>
+            {};
+
+            // Stable insertion sort of layer indices, highest priority first, evaluated once at compile time
+            template <typename... Layers>
+            constexpr std::array<std::size_t, sizeof...(Layers)> PriorityOrder()
+            {
+                constexpr std::array<int, sizeof...(Layers)> priorities = { layer_priority<Layers>::value... };
+
+                std::array<std::size_t, sizeof...(Layers)> order {};
+                for (std::size_t i = 0; i < order.size(); ++i)
+                    order[i] = i;
+
+                for (std::size_t i = 1; i < order.size(); ++i)
+                {
+                    for (std::size_t j = i; j > 0 && priorities[order[j - 1]] < priorities[order[j]]; --j)
+                    {
+                        const std::size_t moved = order[j];
+                        order[j]                = order[j - 1];
+                        order[j - 1]            = moved;
+                    }
+                }
+                return order;
+            }
+
+            // Picks the layers in the computed order with a single pack expansion
+            template <typename Stack, typename Indices>
+            struct SortByPriority;
+
+            template <typename... Layers, std::size_t... I>
+            struct SortByPriority<Strata<Layers...>, std::index_sequence<I...>>
+            {
+                static constexpr auto kOrder = PriorityOrder<Layers...>();
+
+                using type = Strata<std::tuple_element_t<kOrder[I], std::tuple<Layers...>>...>;
+            };
+
+            template <bool kSort, typename Stack>
+            struct OrderLayers
+            {
+                using type = Stack;
+            };
+
+            template <typename... Layers>
+            struct OrderLayers<true, Strata<Layers...>> : SortByPriority<Strata<Layers...>, std::index_sequence_for<Layers...>>
+            {};
+
+            /// @brief Helper to filter enabled layers and order them by priority at compile time
+            ///
+            /// Filtering is a single fold, sorting is only instantiated when a layer declares a priority.
+            template <typename... AllLayers>
+            struct EnabledLayers
+            {
+                using type = typename OrderLayers<((layer_priority<AllLayers>::value != 0) || ...),
+                    strata::detail::JoinLayers<strata::detail::KeepIf<LayerTraits<AllLayers>::compiletimeEnabled, AllLayers>...>>::type;
+            };
+
+                // LayerFilter implementation
+            template <typename... Layers>
+            struct LayerFilterImpl
+            {
+                using type = typename EnabledLayers<Layers...>::type;
+            };
+
+            // Specialization for LayerPack
+            template <typename... Layers>
+            struct LayerFilterImpl<LayerPack<Layers...>>
+            {
+                using type = typename EnabledLayers<Layers...>::type;
+            };
+
+            template<typename... Layers>
+            struct EnabledLayerInfoImpl
+            {
+                static constexpr std::array<bool, sizeof...(Layers)> enabled = { LayerTraits<Layers>::compiletimeEnabled... };
+            };
+
+            // Count enabled layers
+            template<typename... Layers>
+            struct CountEnabledLayersImpl
+            {
+                static constexpr size_t value = (0 + ... + IsLayerEnabled<Layers>);
+            };
+
+            // Check if any layers are enabled
+            template<typename... Layers>
+            struct AnyLayersEnabledImpl
+            {
+                static constexpr bool value = (... || IsLayerEnabled<Layers>);
+            };
+
+            /// @brief xorshift64* generator, one stream per thread
+            inline std::uint64_t FastRandom()
+            {
+                static thread_local std::uint64_t state = 0;
+                if (state == 0)
+                    state = (reinterpret_cast<std::uintptr_t>(&state) | 1) * 0x9E3779B97F4A7C15ull;
+
+                state ^= state >> 12;
+                state ^= state << 25;
+                state ^= state >> 27;
+                return state * 0x2545F4914F6CDD1Dull;
+            }
+
+            /// @brief Calls until the next sample, uniform in [1, 2 * rate - 1] so the mean is rate
+            inline std::uint32_t NextSampleInterval(std::uint32_t rate)
+            {
+                return static_cast<std::uint32_t>(1 + FastRandom() % (2 * static_cast<std::uint64_t>(rate) - 1));
+            }
+        }
+
+        /// @brief Switch a runtime-toggleable layer on or off for all subsequent Exec calls
+        template <typename Layer>
+        void SetRuntimeEnabled(bool enabled)
+        {
+            static_assert(strata::detail::runtime_toggle<Layer>::value, "LayerTraits<Layer> must declare runtimeEnabled");
+            const auto bit = strata::detail::RuntimeLayerBit<Layer>();
+            if (enabled)
+                strata::detail::RuntimeLayerMask().fetch_or(bit, std::memory_order_relaxed);
+            else
+                strata::detail::RuntimeLayerMask().fetch_and(~bit, std::memory_order_relaxed);
+        }
+
+        /// @brief Check the current runtime state of a toggleable layer
+        template <typename Layer>
+        bool IsRuntimeEnabled()
+        {
+            static_assert(strata::detail::runtime_toggle<Layer>::value, "LayerTraits<Layer> must declare runtimeEnabled");
+            return strata::detail::RuntimeLayerMask().load(std::memory_order_relaxed) & strata::detail::RuntimeLayerBit<Layer>();
+        }
+
+        /// @brief Runs Layer's hooks for roughly one in every Rate calls of each operation
+        ///
+        /// The decision is made once per Exec from a thread-local countdown, so
+        /// Before and After always agree and unsampled calls cost a decrement.
+        /// SetRate() adjusts the rate at runtime; 0 disables the layer and 1
+        /// runs it on every call. Enablement follows LayerTraits<Layer>.
+        template <typename Layer, std::uint32_t Rate>
+        struct Sampled
+        {
+            using HookLayer = Layer;
+
+            static void          SetRate(std::uint32_t rate) { rate_.store(rate, std::memory_order_relaxed); }
+            static std::uint32_t GetRate() { return rate_.load(std::memory_order_relaxed); }
+
+            template <typename Op>
+            static bool Active()
+            {
+                const auto rate = GetRate();
+                if (rate <= 1)
+                    return rate == 1;
+
+                static thread_local std::uint32_t countdown = detail::NextSampleInterval(rate);
+                if (--countdown > 0)
+                    return false;
+
+                countdown = detail::NextSampleInterval(rate);
+                return true;
+            }
+
+        private:
+            static inline std::atomic<std::uint32_t> rate_ { Rate };
+        };
+    }
+
+    template <typename Layer, std::uint32_t Rate>
+    struct LayerTraits<util::Sampled<Layer, Rate>> : LayerTraits<Layer>
+    {};
+
+
+    ////////////////////////////////////////
+    // Built-in Layers
+    ////////////////////////////////////////
+
+    namespace util
+    {
+        /// @brief Log-bucketed latency distribution in nanoseconds
+        ///
+        /// Buckets follow the HDR layout: values below 2^kSubBucketBits are exact,
+        /// larger values keep kSubBucketBits of precision (about 6% relative error).
+        struct LatencyDistribution
+        {
+            static constexpr std::size_t kSubBucketBits = 4;
+            static constexpr std::size_t kMaxValueBits  = 40;
+            static constexpr std::size_t kBucketCount   = (kMaxValueBits - kSubBucketBits + 1) << kSubBucketBits;
+
+            std::array<std::uint64_t, kBucketCount> buckets {};
+            std::uint64_t                           count = 0;
+            std::uint64_t                           total = 0;
+            std::uint64_t                           min   = UINT64_MAX;
+            std::uint64_t                           max   = 0;
+
+            static std::size_t BucketIndex(std::uint64_t value)
+            {
+                constexpr std::uint64_t kSubBuckets = std::uint64_t { 1 } << kSubBucketBits;
+                if (value < kSubBuckets)
+                    return static_cast<std::size_t>(value);
+
+                std::size_t msb = 0;
+                for (auto v = value; v >>= 1;)
+                    ++msb;
+                if (msb >= kMaxValueBits)
+                    return kBucketCount - 1;
+
+                const std::size_t shift = msb - kSubBucketBits;
+                return ((shift + 1) << kSubBucketBits) + static_cast<std::size_t>((value >> shift) - kSubBuckets);
+            }
+
+            /// @brief Largest value that maps to the bucket
+            static std::uint64_t BucketUpperBound(std::size_t index)
+            {
+                constexpr std::size_t kSubBuckets = std::size_t { 1 } << kSubBucketBits;
+                if (index < kSubBuckets)
+                    return index;
+
+                const std::size_t   shift = (index >> kSubBucketBits) - 1;
+                const std::uint64_t lower = static_cast<std::uint64_t>((index & (kSubBuckets - 1)) + kSubBuckets) << shift;
+                return lower + (std::uint64_t { 1 } << shift) - 1;
+            }
+
+            /// @brief Value at or below which `percent` of the samples fall
+            std::uint64_t percentile(double percent) const
+            {
+                if (count == 0)
+                    return 0;
+
+                const auto target = static_cast<std::uint64_t>(std::ceil(percent / 100.0 * static_cast<double>(count)));
+                std::uint64_t seen = 0;
+                for (std::size_t i = 0; i < kBucketCount; ++i)
+                {
+                    seen += buckets[i];
+                    if (seen >= target && seen > 0)
+                        return std::clamp(BucketUpperBound(i), min, max);
+                }
+                return max;
+            }
+
+            double mean() const { return count ? static_cast<double>(total) / static_cast<double>(count) : 0.0; }
+
+            LatencyDistribution& operator+=(const LatencyDistribution& other)
+            {
+                for (std::size_t i = 0; i < kBucketCount; ++i)
+                    buckets[i] += other.buckets[i];
+                count += other.count;
+                total += other.total;
+                min    = std::min(min, other.min);
+                max    = std::max(max, other.max);
+                return *this;
+            }
+        };
+
+        namespace detail
+        {
+            /// @brief Single-writer histogram owned by one thread and read by snapshots
+            struct alignas(strata::detail::kCacheLineSize) LatencyShard
+            {
+                using Totals = LatencyDistribution;
+
+                std::array<std::atomic<std::uint64_t>, LatencyDistribution::kBucketCount> buckets {};
+                std::atomic<std::uint64_t>                                                count { 0 };
+                std::atomic<std::uint64_t>                                                total { 0 };
+                std::atomic<std::uint64_t>                                                min { UINT64_MAX };
+                std::atomic<std::uint64_t>                                                max { 0 };
+
+                // Only the owning thread writes, so plain load/store pairs suffice
+                static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t amount)
+                {
+                    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+                }
+
+                void record(std::uint64_t nanos)
+                {
+                    bump(buckets[LatencyDistribution::BucketIndex(nanos)], 1);
+                    bump(count, 1);
+                    bump(total, nanos);
+                    if (nanos < min.load(std::memory_order_relaxed))
+                        min.store(nanos, std::memory_order_relaxed);
+                    if (nanos > max.load(std::memory_order_relaxed))
+                        max.store(nanos, std::memory_order_relaxed);
+                }
+
+                void collect(LatencyDistribution& into) const
+                {
+                    LatencyDistribution shard;
+                    for (std::size_t i = 0; i < LatencyDistribution::kBucketCount; ++i)
+                        shard.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+                    shard.count = count.load(std::memory_order_relaxed);
+                    shard.total = total.load(std::memory_order_relaxed);
+                    shard.min   = min.load(std::memory_order_relaxed);
+                    shard.max   = max.load(std::memory_order_relaxed);
+                    into += shard;
+                }
+
+                void reset()
+                {
+                    for (auto& bucket : buckets)
+                        bucket.store(0, std::memory_order_relaxed);
+                    count.store(0, std::memory_order_relaxed);
+                    total.store(0, std::memory_order_relaxed);
+                    min.store(UINT64_MAX, std::memory_order_relaxed);
+                    max.store(0, std::memory_order_relaxed);
+                }
+            };
+
+            /// @brief Live per-thread shards of one operation plus totals of exited threads
+            ///
+            /// Shard declares its merged `Totals` type, `collect(Totals&) const` and `reset()`.
+            template <typename Shard, typename Op>
+            class ShardedRecorder
+            {
+            private:
+                using Totals = typename Shard::Totals;
+
+                struct Registry
+                {
+                    std::mutex          mutex;
+                    std::vector<Shard*> live;
+                    Totals              retired;
+                };
+
+                struct ThreadShard
+                {
+                    Shard shard;
+
+                    ThreadShard()
+                    {
+                        auto&                       registry = GetRegistry();
+                        std::lock_guard<std::mutex> lock(registry.mutex);
+                        registry.live.push_back(&shard);
+                    }
+
+                    ~ThreadShard()
+                    {
+                        auto&                       registry = GetRegistry();
+                        std::lock_guard<std::mutex> lock(registry.mutex);
+                        shard.collect(registry.retired);
+                        registry.live.erase(std::find(registry.live.begin(), registry.live.end(), &shard));
+                    }
+                };
+
+                static Registry& GetRegistry()
+                {
+                    static Registry registry;
+                    return registry;
+                }
+
+            public:
+                static Shard& Local()
+                {
+                    static thread_local ThreadShard local;
+                    return local.shard;
+                }
+
+                static Totals Snapshot()
+                {
+                    auto&                       registry = GetRegistry();
+                    std::lock_guard<std::mutex> lock(registry.mutex);
+                    Totals                      result = registry.retired;
+                    for (const auto* shard : registry.live)
+                        shard->collect(result);
+                    return result;
+                }
+
+                // Concurrent recordings during a reset may survive it
+                static void Reset()
+                {
+                    auto&                       registry = GetRegistry();
+                    std::lock_guard<std::mutex> lock(registry.mutex);
+                    registry.retired = Totals {};
+                    for (auto* shard : registry.live)
+                        shard->reset();
+                }
+            };
+
+            template <typename Op>
+            using LatencyRecorder = ShardedRecorder<LatencyShard, Op>;
+        }
+
+        /// @brief Records the latency of each operation into per-thread histograms
+        ///
+        /// Place it last in the stack so its hooks run directly around the core
+        /// function. Recording takes no lock and allocates nothing; Snapshot<Op>()
+        /// merges all threads. The start time travels from Before to After as the
+        /// hook token, so nested and recursive calls are measured independently.
+        struct LatencyHistogram
+        {
+            template <typename Op>
+            struct Impl
+            {
+                template <typename... Args>
+                static std::chrono::steady_clock::time_point Before(Args&&...)
+                {
+                    return std::chrono::steady_clock::now();
+                }
+
+                template <typename... Args>
+                static void After(std::chrono::steady_clock::time_point start, Args&&...)
+                {
+                    const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                    detail::LatencyRecorder<Op>::Local().record(static_cast<std::uint64_t>(nanos));
+                }
+            };
+
+            template <typename Op>
+            static LatencyDistribution Snapshot() { return detail::LatencyRecorder<Op>::Snapshot(); }
+
+            template <typename Op>
+            static void Reset() { detail::LatencyRecorder<Op>::Reset(); }
+        };
+    }
+
+    template <>
+    struct LayerConcurrencyTraits<util::LatencyHistogram>
+    {
+        static constexpr bool threadSafe = true;
+    };
+
+    namespace detail
+    {
+        /// @brief Heap allocations made by the calling thread, counted by STRATA_COUNT_ALLOCATIONS
+        struct AllocationTally
+        {
+            std::uint64_t count = 0;
+            std::uint64_t bytes = 0;
+        };
+
+        inline AllocationTally& ThreadAllocations() noexcept
+        {
+            static thread_local AllocationTally tally;
+            return tally;
+        }
+
+        inline void* CountedAllocate(std::size_t size)
+        {
+            auto& tally = ThreadAllocations();
+            tally.count++;
+            tally.bytes += size;
+
+            while (true)
+            {
+                if (void* memory = std::malloc(size ? size : 1))
+                    return memory;
+                if (auto handler = std::get_new_handler())
+                    handler();
+                else
+                    throw std::bad_alloc();
+            }
+        }
+    }
+
+    // GCC pairs the replaced operator new with the free() inside the replaced delete
+    // and reports them as mismatched wherever both get inlined
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+    #define STRATA_DETAIL_ALLOCATION_DIAGNOSTICS_PUSH \
+        _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wmismatched-new-delete\"")
+    #define STRATA_DETAIL_ALLOCATION_DIAGNOSTICS_POP _Pragma("GCC diagnostic pop")
+#else
+    #define STRATA_DETAIL_ALLOCATION_DIAGNOSTICS_PUSH
+    #define STRATA_DETAIL_ALLOCATION_DIAGNOSTICS_POP
+#endif
+
+    /// Replaces the global allocation functions with ones that count into
+    /// detail::ThreadAllocations, the source of util::AllocationCounter. Place it at
+    /// namespace scope in exactly one source file of the program. Over-aligned
+    /// allocations keep the default functions and are not counted.
+    #define STRATA_COUNT_ALLOCATIONS()                                                                  \
+        STRATA_DETAIL_ALLOCATION_DIAGNOSTICS_PUSH                                                      \
+        void* operator new(std::size_t size) { return strata::detail::CountedAllocate(size); }         \
+        void* operator new[](std::size_t size) { return strata::detail::CountedAllocate(size); }       \
+        void  operator delete(void* memory) noexcept { std::free(memory); }                            \
+        void  operator delete[](void* memory) noexcept { std::free(memory); }                          \
+        void  operator delete(void* memory, std::size_t) noexcept { std::free(memory); }               \
+        void  operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }             \
+        STRATA_DETAIL_ALLOCATION_DIAGNOSTICS_POP
+
+    namespace util
+    {
+        /// @brief Heap allocations made inside the calls of one operation
+        struct AllocationStats
+        {
+            std::uint64_t calls       = 0;
+            std::uint64_t allocations = 0;
+            std::uint64_t bytes       = 0;
+
+            double allocationsPerCall() const { return calls ? static_cast<double>(allocations) / static_cast<double>(calls) : 0.0; }
+            double bytesPerCall() const { return calls ? static_cast<double>(bytes) / static_cast<double>(calls) : 0.0; }
+        };
+
+        namespace detail
+        {
+            struct alignas(strata::detail::kCacheLineSize) AllocationShard
+            {
+                using Totals = AllocationStats;
+
+                std::atomic<std::uint64_t> calls { 0 };
+                std::atomic<std::uint64_t> allocations { 0 };
+                std::atomic<std::uint64_t> bytes { 0 };
+
+                void record(std::uint64_t count, std::uint64_t size)
+                {
+                    LatencyShard::bump(calls, 1);
+                    LatencyShard::bump(allocations, count);
+                    LatencyShard::bump(bytes, size);
+                }
+
+                void collect(AllocationStats& into) const
+                {
+                    into.calls       += calls.load(std::memory_order_relaxed);
+                    into.allocations += allocations.load(std::memory_order_relaxed);
+                    into.bytes       += bytes.load(std::memory_order_relaxed);
+                }
+
+                void reset()
+                {
+                    calls.store(0, std::memory_order_relaxed);
+                    allocations.store(0, std::memory_order_relaxed);
+                    bytes.store(0, std::memory_order_relaxed);
+                }
+            };
+        }
+
+        /// @brief Counts the heap allocations made during each operation, per thread
+        ///
+        /// Requires STRATA_COUNT_ALLOCATIONS() in one source file, without it every call
+        /// counts zero. Place it last in the stack so only the core function is measured.
+        /// Counts come from the thread running the call, so allocations the core hands
+        /// off to other threads are not included.
+        struct AllocationCounter
+        {
+            template <typename Op>
+            struct Impl
+            {
+                template <typename... Args>
+                static strata::detail::AllocationTally Before(Args&&...)
+                {
+                    return strata::detail::ThreadAllocations();
+                }
+
+                template <typename... Args>
+                static void After(strata::detail::AllocationTally start, Args&&...)
+                {
+                    const auto now = strata::detail::ThreadAllocations();
+                    detail::ShardedRecorder<detail::AllocationShard, Op>::Local().record(now.count - start.count, now.bytes - start.bytes);
+                }
+            };
+
+            template <typename Op>
+            static AllocationStats Snapshot() { return detail::ShardedRecorder<detail::AllocationShard, Op>::Snapshot(); }
+
+            template <typename Op>
+            static void Reset() { detail::ShardedRecorder<detail::AllocationShard, Op>::Reset(); }
+        };
+    }
+
+    template <>
+    struct LayerConcurrencyTraits<util::AllocationCounter>
+    {
+        static constexpr bool threadSafe = true;
+    };
+
+    namespace util
+    {
+        /// @brief Records every call as a begin/end trace event and exports Chrome trace JSON
+        ///
+        /// Events go to a fixed-size ring per thread without locks or allocation, the oldest
+        /// are overwritten once a ring is full. Place it first so the span covers the whole
+        /// call; every other layer of the stack adds a nested span for each of its hooks,
+        /// named after the layer. A layer declaring `traceHooks = false` in its LayerTraits is
+        /// left out, `traceHooks = true` traces it in stacks without ChromeTrace. Export() copies the rings while threads keep recording and renders
+        /// the JSON accepted by chrome://tracing and Perfetto, timestamps relative to the
+        /// oldest event. Rings of exited threads are exported until Clear().
+        struct ChromeTrace
+        {
+            static constexpr std::size_t kRingCapacity = strata::detail::TraceRing::kCapacity;
+
+            template <typename Op>
+            struct Impl
+            {
+                template <typename... Args>
+                static bool Before(Args&&...)
+                {
+                    auto* ring = strata::detail::TraceRegistry::Active();
+                    if (ring)
+                        ring->record(strata::detail::kCallTraceSite<Op>, false);
+                    return ring != nullptr;
+                }
+
+                // A call that began before capture stopped still ends its span
+                template <typename... Args>
+                static void After(bool begun, Args&&...)
+                {
+                    if (begun)
+                        strata::detail::TraceRegistry::Local().record(strata::detail::kCallTraceSite<Op>, true);
+                }
+            };
+
+            /// @brief Pause or resume recording, calls already in progress finish their spans
+            static void SetCapturing(bool capturing) { strata::detail::TraceCapturing().store(capturing, std::memory_order_relaxed); }
+            static bool IsCapturing() { return strata::detail::TraceCapturing().load(std::memory_order_relaxed); }
+
+            /// @brief Drop all recorded events and the rings of exited threads
+            static void Clear() { strata::detail::TraceRegistry::GetInstance().clear(); }
+
+            /// @brief Chrome trace event JSON of all events currently held
+            static std::string Export()
+            {
+                using Event = strata::detail::TraceRing::Event;
+
+                std::vector<std::pair<std::uint32_t, std::vector<Event>>> threads;
+                strata::detail::TraceRegistry::GetInstance().forEach([&](const strata::detail::TraceRing& ring) {
+                    threads.emplace_back(ring.thread(), std::vector<Event> {});
+                    ring.copy(threads.back().second);
+                });
+
+                std::uint64_t origin = UINT64_MAX;
+                for (const auto& [thread, events] : threads)
+                {
+                    if (!events.empty())
+                        origin = std::min(origin, events.front().nanos());
+                }
+
+                std::string json  = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+                bool        first = true;
+                for (const auto& [thread, events] : threads)
+                {
+                    // End events whose begin was overwritten would close unrelated spans
+                    std::size_t depth = 0;
+                    for (const auto& event : events)
+                    {
+                        if (event.end() && depth == 0)
+                            continue;
+                        depth = event.end() ? depth - 1 : depth + 1;
+
+                        json += first ? "\n" : ",\n";
+                        first = false;
+                        AppendEvent(json, event, event.nanos() - origin, thread);
+                    }
+                }
+                json += "\n]}\n";
+                return json;
+            }
+
+        private:
+            static void AppendString(std::string& json, std::string_view text)
+            {
+                json += '"';
+                for (char c : text)
+                {
+                    if (c == '"' || c == '\\')
+                        json += '\\';
+                    json += c;
+                }
+                json += '"';
+            }
+
+            static void AppendEvent(std::string& json, const strata::detail::TraceRing::Event& event, std::uint64_t nanos, std::uint32_t thread)
+            {
+                const std::string fraction = std::to_string(1000 + nanos % 1000);
+
+                json += "{\"name\":";
+                AppendString(json, event.site->name);
+                json += ",\"cat\":";
+                AppendString(json, event.site->category);
+                json += event.end() ? ",\"ph\":\"E\"" : ",\"ph\":\"B\"";
+                json += ",\"ts\":" + std::to_string(nanos / 1000) + "." + fraction.substr(1);
+                json += ",\"pid\":1,\"tid\":" + std::to_string(thread);
+                if (!event.site->hook.empty())
+                {
+                    json += ",\"args\":{\"hook\":";
+                    AppendString(json, event.site->hook);
+                    json += "}";
+                }
+                json += "}";
+            }
+        };
+    }
+
+    template <>
+    struct LayerConcurrencyTraits<util::ChromeTrace>
+    {
+        static constexpr bool threadSafe = true;
+    };
+
+    namespace util
+    {
+        namespace detail
+        {
+            // Hash of an argument tuple, combining std::hash of each element
+            //
+            // std::hash is the identity for integers, so the combined value is finalized
+            // with the murmur3 mixer to spread small keys over all bits before the cache
+            // picks a shard from the upper ones and a bucket from the lower ones.
+            struct ArgumentsHash
+            {
+                static std::uint64_t Mix(std::uint64_t hash)
+                {
+                    hash ^= hash >> 33;
+                    hash *= 0xff51afd7ed558ccdull;
+                    hash ^= hash >> 33;
+                    hash *= 0xc4ceb9fe1a85ec53ull;
+                    hash ^= hash >> 33;
+                    return hash;
+                }
+
+                template <typename... T>
+                std::size_t operator()(const std::tuple<T...>& arguments) const
+                {
+                    std::size_t seed = 0;
+                    std::apply([&](const auto&... values) {
+                        ((seed ^= std::hash<std::decay_t<decltype(values)>> {}(values) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)), ...);
+                    }, arguments);
+                    return static_cast<std::size_t>(Mix(seed));
+                }
+            };
+
+            /// @brief Bounded LRU cache split into independently locked shards
+            template <typename Key, typename Value, std::size_t kCapacity, std::size_t kShards>
+            class ShardedLruCache
+            {
+            public:
+                /// @brief Key with its hash, computed once per call and carried from Before to After
+                struct Entry
+                {
+                    Key         key;
+                    std::size_t hash;
+                };
+
+            private:
+                static constexpr std::size_t kShardCapacity = kCapacity / kShards > 0 ? kCapacity / kShards : 1;
+
+                struct PassHash
+                {
+                    std::size_t operator()(std::size_t hash) const noexcept { return hash; }
+                };
+
+                struct Node
+                {
+                    Key         key;
+                    Value       value;
+                    std::size_t hash;
+                };
+
+                // Most recently used first
+                using Order = std::list<Node>;
+
+                struct alignas(strata::detail::kCacheLineSize) Shard
+                {
+                    std::mutex                                                               mutex;
+                    Order                                                                    order;
+                    std::unordered_multimap<std::size_t, typename Order::iterator, PassHash> index;
+
+                    typename Order::iterator find(const Entry& entry)
+                    {
+                        auto range = index.equal_range(entry.hash);
+                        for (auto it = range.first; it != range.second; ++it)
+                        {
+                            if (it->second->key == entry.key)
+                                return it->second;
+                        }
+                        return order.end();
+                    }
+
+                    void evict()
+                    {
+                        auto oldest = std::prev(order.end());
+                        auto range  = index.equal_range(oldest->hash);
+                        for (auto it = range.first; it != range.second; ++it)
+                        {
+                            if (it->second == oldest)
+                            {
+                                index.erase(it);
+                                break;
+                            }
+                        }
+                        order.pop_back();
+                    }
+                };
+
+                std::array<Shard, kShards> shards_;
+
+                // Upper hash bits pick the shard so the index buckets use the lower ones
+                Shard& shardFor(std::size_t hash) { return shards_[(hash >> (sizeof(std::size_t) * 4)) % kShards]; }
+
+            public:
+                std::optional<Value> find(const Entry& entry)
+                {
+                    Shard&                      shard = shardFor(entry.hash);
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    auto                        it = shard.find(entry);
+                    if (it == shard.order.end())
+                        return std::nullopt;
+
+                    shard.order.splice(shard.order.begin(), shard.order, it);
+                    return it->value;
+                }
+
+                void insert(Entry& entry, const Value& value)
+                {
+                    Shard&                      shard = shardFor(entry.hash);
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    auto                        it = shard.find(entry);
+                    if (it != shard.order.end())
+                    {
+                        it->value = value;
+                        shard.order.splice(shard.order.begin(), shard.order, it);
+                        return;
+                    }
+
+                    shard.order.push_front(Node { std::move(entry.key), value, entry.hash });
+                    shard.index.emplace(entry.hash, shard.order.begin());
+                    if (shard.order.size() > kShardCapacity)
+                        shard.evict();
+                }
+
+                void clear()
+                {
+                    for (auto& shard : shards_)
+                    {
+                        std::lock_guard<std::mutex> lock(shard.mutex);
+                        shard.index.clear();
+                        shard.order.clear();
+                    }
+                }
+
+                std::size_t size()
+                {
+                    std::size_t total = 0;
+                    for (auto& shard : shards_)
+                    {
+                        std::lock_guard<std::mutex> lock(shard.mutex);
+                        total += shard.order.size();
+                    }
+                    return total;
+                }
+            };
+
+            template <typename Op, std::size_t kCapacity, std::size_t kShards>
+            using MemoCache = ShardedLruCache<typename Op::BatchArguments, std::decay_t<typename Op::ReturnType>, kCapacity, kShards>;
+
+            template <typename Op, std::size_t kCapacity, std::size_t kShards>
+            MemoCache<Op, kCapacity, kShards>& MemoCacheFor()
+            {
+                static MemoCache<Op, kCapacity, kShards> cache;
+                return cache;
+            }
+        }
+
+        /// @brief Caches results of pure operations, keyed by their hashed arguments
+        ///
+        /// A hit returns the cached result from Before and skips the core function and
+        /// all inner layers; a miss stores the core's result in After. Each operation has
+        /// its own cache of at most kCapacity entries, split into kShards LRU shards with a
+        /// lock each. Argument types need std::hash and `operator==`.
+        template <std::size_t kCapacity = 1024, std::size_t kShards = 16>
+        struct Memoize
+        {
+            static_assert(kShards > 0, "Memoize needs at least one shard");
+
+            template <typename Op>
+            struct Impl
+            {
+                template <typename... Args, typename O = Op>
+                static ShortCircuit<typename O::ReturnType, typename detail::MemoCache<O, kCapacity, kShards>::Entry> Before(const Args&... args)
+                {
+                    static_assert(!std::is_void_v<typename O::ReturnType>, "Memoize requires a value-returning operation");
+
+                    typename detail::MemoCache<O, kCapacity, kShards>::Entry entry { typename O::BatchArguments(args...), 0 };
+                    entry.hash = detail::ArgumentsHash {}(entry.key);
+
+                    if (auto cached = detail::MemoCacheFor<O, kCapacity, kShards>().find(entry))
+                        return std::move(*cached);
+
+                    return ShortCircuit<typename O::ReturnType, typename detail::MemoCache<O, kCapacity, kShards>::Entry>::Continue(std::move(entry));
+                }
+
+                template <typename Entry, typename Result, typename... Args>
+                static void After(Entry& entry, const Result& result, const Args&...)
+                {
+                    detail::MemoCacheFor<Op, kCapacity, kShards>().insert(entry, result);
+                }
+            };
+
+            /// @brief Number of results cached for an operation
+            template <typename Op>
+            static std::size_t Size() { return detail::MemoCacheFor<Op, kCapacity, kShards>().size(); }
+
+            /// @brief Drop every cached result of an operation
+            template <typename Op>
+            static void Clear() { detail::MemoCacheFor<Op, kCapacity, kShards>().clear(); }
+        };
+    }
+
+    template <std::size_t kCapacity, std::size_t kShards>
+    struct LayerConcurrencyTraits<util::Memoize<kCapacity, kShards>>
+    {
+        static constexpr bool threadSafe = true;
+    };
+
+
+    ////////////////////////////////////////
+    // Layer State Manager
+    ////////////////////////////////////////
+
+    namespace detail
+    {
+        /// @brief Minimal test-and-test-and-set lock for short critical sections
+        class SpinLock
+        {
+        private:
+            std::atomic<bool> locked_ { false };
+
+        public:
+            void lock() noexcept
+            {
+                while (locked_.exchange(true, std::memory_order_acquire))
+                {
+                    while (locked_.load(std::memory_order_relaxed))
+                        std::this_thread::yield();
+                }
+            }
+
+            bool try_lock() noexcept { return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire); }
+            void unlock() noexcept { locked_.store(false, std::memory_order_release); }
+        };
+
+        /// @brief Small dense index assigned to each thread on first use
+        ///
+        /// Indices are handed back when a thread exits, so live threads always
+        /// hold distinct ones and the range stays bounded by the peak number of
+        /// concurrent threads.
+        inline std::size_t ThisThreadIndex()
+        {
+            struct Indices
+            {
+                std::mutex               mutex;
+                std::vector<std::size_t> free;
+                std::size_t              next = 0;
+            };
+            static Indices indices;
+
+            struct Slot
+            {
+                std::size_t index;
+
+                Slot()
+                {
+                    std::lock_guard<std::mutex> lock(indices.mutex);
+                    if (indices.free.empty())
+                    {
+                        index = indices.next++;
+                    }
+                    else
+                    {
+                        index = indices.free.back();
+                        indices.free.pop_back();
+                    }
+                }
+
+                ~Slot()
+                {
+                    std::lock_guard<std::mutex> lock(indices.mutex);
+                    indices.free.push_back(index);
+                }
+            };
+            static thread_local Slot slot;
+            return slot.index;
+        }
+    }
+
+    /// @brief Merge policy used to combine per-thread shards of a ShardedLayerState
+    ///
+    /// Defaults to `operator+=`; specialize for state types that need another rule.
+    template <typename T>
+    struct LayerStateMerge
+    {
+        static void Merge(T& into, const T& shard) { into += shard; }
+    };
+
+    /// @brief Per-thread sharded state for write-heavy hot paths
+    ///
+    /// Each thread updates its own cache-line-padded copy of T, so concurrent
+    /// writers never touch the same memory. Shards are combined with
+    /// LayerStateMerge<T> on read() or folded back into the base value by aggregate().
+    ///
+    /// Shards are indexed by detail::ThisThreadIndex(). The first kShardCount
+    /// threads use inline shards, later ones lazily allocated segments of the
+    /// same size. A thread that exits leaves its counts in its shard for the
+    /// next thread given the same index. Threads past kShardCount * kMaxSegments
+    /// concurrent ones share one spill shard behind a spin lock.
+    ///
+    /// For trivially copyable T an owned shard is updated without any atomic
+    /// read-modify-write: the owner brackets its update with a sequence counter
+    /// that only read() and aggregate() retry on. Other types lock their shard.
+    /// Readers never write into a shard; aggregate() and reset() bump an epoch
+    /// instead, and each owner folds or drops its shard on its next update.
+    template <typename T>
+    class ShardedLayerState
+    {
+    public:
+        static constexpr std::size_t kShardCount  = 64;
+        static constexpr std::size_t kMaxSegments = 64;
+        static constexpr bool        kLockFree    = std::is_trivially_copyable_v<T>;
+
+    private:
+        struct alignas(detail::kCacheLineSize) Shard
+        {
+            std::atomic<std::uint64_t> sequence { 0 }; // Odd while an update is in flight
+            detail::SpinLock           lock;
+            std::uint64_t              epoch      = 0; // Both written by the owner while holding mutex_
+            std::uint64_t              resetEpoch = 0;
+            T                          data {};
+        };
+
+        using Segment = std::array<Shard, kShardCount>;
+
+        mutable std::mutex                                           mutex_;
+        T                                                            base_ {};
+        std::atomic<std::uint64_t>                                   epoch_ { 0 };
+        std::uint64_t                                                resetEpoch_ = 0;
+        mutable Segment                                              shards_;
+        mutable std::array<std::atomic<Segment*>, kMaxSegments - 1> overflow_ {};
+        mutable Shard                                                spill_;
+
+        // The returned flag tells whether other threads may write the shard too
+        std::pair<Shard*, bool> localShard() const
+        {
+            const std::size_t index = detail::ThisThreadIndex();
+            if (index < kShardCount)
+                return { &shards_[index], false };
+            if (index >= kShardCount * kMaxSegments)
+                return { &spill_, true };
+
+            auto&    slot    = overflow_[index / kShardCount - 1];
+            Segment* segment = slot.load(std::memory_order_acquire);
+            if (!segment)
+            {
+                // Racing threads agree on whichever segment is published first
+                auto created = std::make_unique<Segment>();
+                if (slot.compare_exchange_strong(segment, created.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+                    segment = created.release();
+            }
+            return { &(*segment)[index % kShardCount], false };
+        }
+
+        template <typename F>
+        void forEachShard(F&& func) const
+        {
+            for (auto& shard : shards_)
+                func(shard);
+            for (const auto& slot : overflow_)
+            {
+                if (Segment* segment = slot.load(std::memory_order_acquire))
+                {
+                    for (auto& shard : *segment)
+                        func(shard);
+                }
+            }
+            func(spill_);
+        }
+
+        // Runs on the writer once aggregate() or reset() moved the epoch on
+        void catchUp(Shard& shard)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (shard.resetEpoch == resetEpoch_)
+                LayerStateMerge<T>::Merge(base_, shard.data);
+            shard.data       = T {};
+            shard.epoch      = epoch_.load(std::memory_order_relaxed);
+            shard.resetEpoch = resetEpoch_;
+        }
+
+        // Requires mutex_, shards left behind by a reset count as empty
+        T mergedLocked() const
+        {
+            T result = base_;
+            forEachShard([this, &result](Shard& shard) {
+                if (shard.resetEpoch != resetEpoch_)
+                    return;
+
+                if constexpr (kLockFree)
+                {
+                    T copy;
+                    for (;;)
+                    {
+                        auto before = shard.sequence.load(std::memory_order_acquire);
+                        if (before & 1)
+                        {
+                            std::this_thread::yield();
+                            continue;
+                        }
+
+                        std::memcpy(&copy, &shard.data, sizeof(T));
+                        std::atomic_thread_fence(std::memory_order_acquire);
+
+                        if (shard.sequence.load(std::memory_order_relaxed) == before)
+                            break;
+                    }
+                    LayerStateMerge<T>::Merge(result, copy);
+                }
+                else
+                {
+                    std::lock_guard<detail::SpinLock> shardLock(shard.lock);
+                    LayerStateMerge<T>::Merge(result, shard.data);
+                }
+            });
+            return result;
+        }
+
+    public:
+        ShardedLayerState() = default;
+        ~ShardedLayerState()
+        {
+            for (auto& slot : overflow_)
+                delete slot.load(std::memory_order_relaxed);
+        }
+
+        ShardedLayerState(const ShardedLayerState&)            = delete;
+        ShardedLayerState& operator=(const ShardedLayerState&) = delete;
+
+        class Proxy
+        {
+        private:
+            Shard&                             shard_;
+            std::unique_lock<detail::SpinLock> lock_;
+
+        public:
+            Proxy(ShardedLayerState& state, std::pair<Shard*, bool> shard)
+                : shard_(*shard.first)
+            {
+                if (!kLockFree || shard.second)
+                    lock_ = std::unique_lock<detail::SpinLock>(shard_.lock);
+
+                if (shard_.epoch != state.epoch_.load(std::memory_order_acquire))
+                    state.catchUp(shard_);
+
+                if constexpr (kLockFree)
+                {
+                    shard_.sequence.store(shard_.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+                }
+            }
+
+            ~Proxy()
+            {
+                if constexpr (kLockFree)
+                    shard_.sequence.store(shard_.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            Proxy(const Proxy&)            = delete;
+            Proxy& operator=(const Proxy&) = delete;
+
+            T*       operator->() { return &shard_.data; }
+            const T* operator->() const { return &shard_.data; }
+        };
+
+        /// @brief Access the calling thread's shard
+        Proxy access() { return Proxy(*this, localShard()); }
+
+        /// @brief Merged view of the base value and every shard
+        T read() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return mergedLocked();
+        }
+
+        /// @brief Fold all shards into the base value and reset them
+        ///
+        /// The returned value covers every shard right away; each shard moves
+        /// into the base value when its owner next updates it.
+        T aggregate()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            epoch_.store(epoch_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            return mergedLocked();
+        }
+
+        /// @brief Reset the base value and every shard to a default-constructed T
+        ///
+        /// Updates racing with the reset may be dropped along with it.
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            base_ = T {};
+            ++resetEpoch_;
+            epoch_.store(epoch_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+    };
+
+    /// @brief Synchronization policies selectable per state type via LayerStateTraits
+    namespace sync
+    {
+        /// @brief Single std::mutex shared by readers and writers (default)
+        struct Exclusive {};
+
+        /// @brief std::shared_mutex so concurrent read() calls do not serialize
+        struct SharedReaders {};
+
+        /// @brief Sequence lock with optimistic, non-blocking read() for trivially copyable T
+        struct SeqLock {};
+
+        /// @brief Listed fields are stored as independent std::atomic members
+        ///
+        /// Updates go through fetch_add<&T::field>() and friends as single relaxed
+        /// atomics with no lock or observers. read() loads each field on its own,
+        /// so it is not a snapshot across fields. Intended for plain counters.
+        template <auto... Fields>
+        struct Atomic {};
+    }
+
+    /// @brief Observer notification policies selectable per state type via LayerStateTraits
+    namespace notify
+    {
+        /// @brief Observers run on the modifying thread while the state is locked (default)
+        struct Immediate {};
+
+        /// @brief Modifications only mark the state dirty; ObserverDispatcher delivers one
+        /// snapshot per interval from its background thread
+        struct Deferred {};
+    }
+
+    /// @brief Storage policies selectable per state type via LayerStateTraits
+    namespace storage
+    {
+        /// @brief State data lives inside the LayerState object (default)
+        struct Inline {};
+
+        /// @brief State data lives in the MappedStateFile attached to the registry, if any
+        ///
+        /// Requires a trivially copyable T. A state adopts the record left by a
+        /// previous process for the same type and context, so counters survive a
+        /// restart. Without an attached file this behaves like Inline.
+        struct Mapped {};
+
+        /// @brief State data lives in the SharedStateSegment attached to the registry, if any
+        ///
+        /// Requires a trivially copyable T. All processes attached to the same
+        /// segment share one record per type and context, guarded by a
+        /// process-shared lock. Without an attached segment this behaves like Inline.
+        struct Shared {};
+    }
+
+    /// @brief Lifetime policies selectable per state type via LayerStateTraits
+    namespace lifetime
+    {
+        /// @brief States live until removeState() or LayerStateRegistry::Clear() (default)
+        struct Unbounded {};
+
+        /// @brief States may be evicted by the type's StateEvictionPolicy
+        ///
+        /// An evicted state's memory is released once the last wrapper or
+        /// handle holding it goes away.
+        struct Evictable {};
+    }
+
+    /// @brief Per-state-type configuration, specialize to change defaults
+    ///
+    /// Specializations only need to declare the members they change.
+    template <typename T>
+    struct LayerStateTraits
+    {
+        using Sync     = sync::Exclusive;
+        using Notify   = notify::Immediate;
+        using Storage  = storage::Inline;
+        using Lifetime = lifetime::Unbounded;
+    };
+
+    namespace detail
+    {
+        template <typename T, typename = void>
+        struct state_sync { using type = sync::Exclusive; };
+
+        template <typename T>
+        struct state_sync<T, std::void_t<typename LayerStateTraits<T>::Sync>> { using type = typename LayerStateTraits<T>::Sync; };
+
+        template <typename T, typename = void>
+        struct state_notify { using type = notify::Immediate; };
+
+        template <typename T>
+        struct state_notify<T, std::void_t<typename LayerStateTraits<T>::Notify>> { using type = typename LayerStateTraits<T>::Notify; };
+
+        template <typename T, typename = void>
+        struct state_storage { using type = storage::Inline; };
+
+        template <typename T>
+        struct state_storage<T, std::void_t<typename LayerStateTraits<T>::Storage>> { using type = typename LayerStateTraits<T>::Storage; };
+
+        template <typename T, typename = void>
+        struct state_lifetime { using type = lifetime::Unbounded; };
+
+        template <typename T>
+        struct state_lifetime<T, std::void_t<typename LayerStateTraits<T>::Lifetime>> { using type = typename LayerStateTraits<T>::Lifetime; };
+
+        // Process-wide lock for policies that don't need one
+        struct NoSharedLock
+        {};
+
+        template <typename T, typename StoragePolicy>
+        class StateData
+        {
+        private:
+            T value_;
+
+        public:
+            using Lock = NoSharedLock;
+
+            T&       get() { return value_; }
+            const T& get() const { return value_; }
+            Lock     lock() const { return {}; }
+        };
+
+        // Starts out inline and is redirected into the mapped file by the registry
+        // before the state is published
+        template <typename T>
+        class StateData<T, storage::Mapped>
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "storage::Mapped requires a trivially copyable state type");
+
+        private:
+            T                           local_;
+            T*                          data_ = &local_;
+            std::shared_ptr<const void> owner_;
+
+        public:
+            using Lock = NoSharedLock;
+
+            T&       get() { return *data_; }
+            const T& get() const { return *data_; }
+            Lock     lock() const { return {}; }
+
+            void bind(T* data, std::shared_ptr<const void> owner)
+            {
+                data_  = data;
+                owner_ = std::move(owner);
+            }
+        };
+
+        class SharedLockGuard;
+
+        template <typename T>
+        class StateData<T, storage::Shared>
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "storage::Shared requires a trivially copyable state type");
+
+        private:
+            T                           local_;
+            T*                          data_ = &local_;
+            std::atomic<std::uint32_t>* lock_ = nullptr;
+            std::shared_ptr<const void> owner_;
+
+        public:
+            using Lock = SharedLockGuard;
+
+            T&       get() { return *data_; }
+            const T& get() const { return *data_; }
+            Lock     lock() const;
+
+            void bind(T* data, std::atomic<std::uint32_t>* lock, std::shared_ptr<const void> owner)
+            {
+                data_  = data;
+                lock_  = lock;
+                owner_ = std::move(owner);
+            }
+        };
+
+        /// @brief Type-erased state awaiting deferred observer delivery
+        class PendingNotification
+        {
+        public:
+            virtual ~PendingNotification() = default;
+            virtual void deliver()         = 0;
+
+            std::atomic<bool> scheduled { false };
+        };
+    }
+
+    /// @brief Background thread delivering notify::Deferred observer notifications
+    ///
+    /// A state is queued at most once until delivered, so any number of
+    /// modifications within one interval coalesce into a single notification
+    /// carrying the latest snapshot.
+    class ObserverDispatcher
+    {
+    private:
+        std::mutex                                               mutex_;
+        std::condition_variable                                  wake_;
+        std::condition_variable                                  idle_;
+        std::vector<std::shared_ptr<detail::PendingNotification>> queue_;
+        std::chrono::milliseconds                                interval_ { 100 };
+        std::size_t                                              inFlight_ = 0;
+        bool                                                     stop_     = false;
+        std::thread                                              worker_;
+
+        ObserverDispatcher()
+            : worker_([this] { run(); }) {}
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stop_)
+            {
+                wake_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+
+                // Coalescing window: later modifications fold into the queued entries
+                wake_.wait_for(lock, interval_, [this] { return stop_; });
+
+                deliverQueued(lock);
+            }
+        }
+
+        void deliverQueued(std::unique_lock<std::mutex>& lock)
+        {
+            auto batch = std::move(queue_);
+            queue_.clear();
+            inFlight_ += batch.size();
+            lock.unlock();
+
+            for (auto& pending : batch)
+            {
+                pending->scheduled.store(false, std::memory_order_release);
+                pending->deliver();
+            }
+
+            lock.lock();
+            inFlight_ -= batch.size();
+            idle_.notify_all();
+        }
+
+    public:
+        ~ObserverDispatcher()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            worker_.join();
+        }
+
+        static ObserverDispatcher& GetInstance()
+        {
+            static ObserverDispatcher instance;
+            return instance;
+        }
+
+        /// @brief Set the coalescing window between a modification and its delivery
+        static void SetInterval(std::chrono::milliseconds interval)
+        {
+            auto&                       dispatcher = GetInstance();
+            std::lock_guard<std::mutex> lock(dispatcher.mutex_);
+            dispatcher.interval_ = interval;
+        }
+
+        /// @brief Deliver everything queued so far on the calling thread and wait for in-flight deliveries
+        static void Flush()
+        {
+            auto&                        dispatcher = GetInstance();
+            std::unique_lock<std::mutex> lock(dispatcher.mutex_);
+            dispatcher.deliverQueued(lock);
+            dispatcher.idle_.wait(lock, [&dispatcher] { return dispatcher.inFlight_ == 0; });
+        }
+
+        void schedule(std::shared_ptr<detail::PendingNotification> pending)
+        {
+            if (pending->scheduled.exchange(true, std::memory_order_acq_rel))
+                return;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push_back(std::move(pending));
+            }
+            wake_.notify_one();
+        }
+    };
+
+    namespace detail
+    {
+        template <typename Policy>
+        class StateSync;
+
+        template <>
+        class StateSync<sync::Exclusive>
+        {
+        private:
+            mutable std::mutex mutex_;
+
+        public:
+            using WriteLock = std::unique_lock<std::mutex>;
+
+            WriteLock lockWrite() const { return WriteLock(mutex_); }
+
+            template <typename T>
+            T read(const T& data) const
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return data;
+            }
+        };
+
+        template <>
+        class StateSync<sync::SharedReaders>
+        {
+        private:
+            mutable std::shared_mutex mutex_;
+
+        public:
+            using WriteLock = std::unique_lock<std::shared_mutex>;
+
+            WriteLock lockWrite() const { return WriteLock(mutex_); }
+
+            template <typename T>
+            T read(const T& data) const
+            {
+                std::shared_lock<std::shared_mutex> lock(mutex_);
+                return data;
+            }
+        };
+
+        template <>
+        class StateSync<sync::SeqLock>
+        {
+        private:
+            mutable std::mutex                 writerMutex_;
+            mutable std::atomic<std::uint64_t> sequence_ { 0 };
+
+        public:
+            // Writers serialize on the mutex and keep the sequence odd while data is in flux
+            class WriteLock
+            {
+            private:
+                std::unique_lock<std::mutex> lock_;
+                std::atomic<std::uint64_t>*  sequence_;
+
+            public:
+                explicit WriteLock(const StateSync& sync)
+                    : lock_(sync.writerMutex_), sequence_(&sync.sequence_)
+                {
+                    sequence_->store(sequence_->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+                }
+
+                WriteLock(WriteLock&& other) noexcept
+                    : lock_(std::move(other.lock_)), sequence_(std::exchange(other.sequence_, nullptr)) {}
+
+                WriteLock(const WriteLock&)            = delete;
+                WriteLock& operator=(const WriteLock&) = delete;
+                WriteLock& operator=(WriteLock&&)      = delete;
+
+                ~WriteLock()
+                {
+                    if (sequence_)
+                        sequence_->store(sequence_->load(std::memory_order_relaxed) + 1, std::memory_order_release);
+                }
+            };
+
+            WriteLock lockWrite() const { return WriteLock(*this); }
+
+            template <typename T>
+            T read(const T& data) const
+            {
+                static_assert(std::is_trivially_copyable_v<T>, "sync::SeqLock requires a trivially copyable state type");
+
+                T result;
+                for (;;)
+                {
+                    auto before = sequence_.load(std::memory_order_acquire);
+                    if (before & 1)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    std::memcpy(&result, &data, sizeof(T));
+                    std::atomic_thread_fence(std::memory_order_acquire);
+
+                    if (sequence_.load(std::memory_order_relaxed) == before)
+                        return result;
+                }
+            }
+        };
+    }
+
+    namespace util
+    {
+        template <typename Signature, std::size_t kCapacity = 64>
+        class InplaceFunction;
+
+        /// @brief Copyable callable wrapper that never allocates
+        ///
+        /// The callable is stored in a kCapacity byte buffer; callables that do
+        /// not fit are rejected at compile time instead of falling back to the heap.
+        template <typename R, typename... Args, std::size_t kCapacity>
+        class InplaceFunction<R(Args...), kCapacity>
+        {
+        private:
+            struct Operations
+            {
+                R (*invoke)(void* callable, Args&&... args);
+                void (*copy)(void* to, const void* from);
+                void (*destroy)(void* callable);
+            };
+
+            template <typename F>
+            static inline constexpr Operations kOperations = {
+                [](void* callable, Args&&... args) -> R { return (*static_cast<F*>(callable))(std::forward<Args>(args)...); },
+                [](void* to, const void* from) { new (to) F(*static_cast<const F*>(from)); },
+                [](void* callable) { static_cast<F*>(callable)->~F(); }
+            };
+
+            alignas(std::max_align_t) unsigned char storage_[kCapacity];
+            const Operations* operations_ = nullptr;
+
+        public:
+            InplaceFunction() = default;
+
+            template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InplaceFunction>>>
+            InplaceFunction(F&& callable)
+            {
+                using Stored = std::decay_t<F>;
+                static_assert(sizeof(Stored) <= kCapacity && alignof(Stored) <= alignof(std::max_align_t),
+                    "Callable does not fit InplaceFunction, capture less or by reference");
+                static_assert(std::is_invocable_r_v<R, Stored&, Args...>, "Callable does not match the signature");
+
+                new (storage_) Stored(std::forward<F>(callable));
+                operations_ = &kOperations<Stored>;
+            }
+
+            InplaceFunction(const InplaceFunction& other)
+                : operations_(other.operations_)
+            {
+                if (operations_)
+                    operations_->copy(storage_, other.storage_);
+            }
+
+            InplaceFunction& operator=(const InplaceFunction& other)
+            {
+                if (this != &other)
+                {
+                    reset();
+                    if (other.operations_)
+                        other.operations_->copy(storage_, other.storage_);
+                    operations_ = other.operations_;
+                }
+                return *this;
+            }
+
+            ~InplaceFunction() { reset(); }
+
+            void reset()
+            {
+                if (operations_)
+                    operations_->destroy(storage_);
+                operations_ = nullptr;
+            }
+
+            explicit operator bool() const { return operations_ != nullptr; }
+
+            R operator()(Args... args) const
+            {
+                return operations_->invoke(const_cast<unsigned char*>(storage_), std::forward<Args>(args)...);
+            }
+        };
+    }
+
+    namespace detail
+    {
+        class ObserverListBase
+        {
+        public:
+            virtual ~ObserverListBase()                                          = default;
+            virtual void unsubscribe(std::uint32_t index, std::uint32_t generation) = 0;
+        };
+    }
+
+    /// @brief Handle returned by addObserver(), unsubscribe() stops further notifications
+    ///
+    /// Dropping the handle keeps the observer registered. The handle does not
+    /// keep the state alive, and unsubscribing after the state is gone is a no-op.
+    class ObserverSubscription
+    {
+    private:
+        std::weak_ptr<detail::ObserverListBase> list_;
+        std::uint32_t                           index_      = 0;
+        std::uint32_t                           generation_ = 0;
+
+    public:
+        ObserverSubscription() = default;
+        ObserverSubscription(std::weak_ptr<detail::ObserverListBase> list, std::uint32_t index, std::uint32_t generation)
+            : list_(std::move(list)), index_(index), generation_(generation) {}
+
+        void unsubscribe()
+        {
+            if (auto list = list_.lock())
+                list->unsubscribe(index_, generation_);
+            list_.reset();
+        }
+    };
+
+    namespace detail
+    {
+        /// @brief Observer slots of one state
+        ///
+        /// Adding and notifying happen under the state's write lock. Unsubscribing
+        /// only clears a slot's flag, under the list's own mutex, so it is O(1)
+        /// and safe from any thread, including from inside an observer. Cleared
+        /// slots are reused by the next add.
+        template <typename T>
+        class ObserverList final : public ObserverListBase
+        {
+        public:
+            using Callback = util::InplaceFunction<void(const T&)>;
+
+            struct Slot
+            {
+                Callback          callback;
+                std::atomic<bool> active { false };
+                std::uint32_t     generation = 0;
+            };
+
+        private:
+            std::mutex                 mutex_;
+            std::deque<Slot>           slots_;
+            std::vector<std::uint32_t> free_;
+            std::atomic<std::size_t>   active_ { 0 };
+
+        public:
+            std::pair<std::uint32_t, std::uint32_t> add(Callback callback)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::uint32_t               index;
+                if (!free_.empty())
+                {
+                    index = free_.back();
+                    free_.pop_back();
+                }
+                else
+                {
+                    index = static_cast<std::uint32_t>(slots_.size());
+                    slots_.emplace_back();
+                }
+
+                Slot& slot     = slots_[index];
+                slot.callback  = std::move(callback);
+                slot.generation++;
+                slot.active.store(true, std::memory_order_release);
+                active_.fetch_add(1, std::memory_order_relaxed);
+                return { index, slot.generation };
+            }
+
+            void unsubscribe(std::uint32_t index, std::uint32_t generation) override
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (index >= slots_.size() || slots_[index].generation != generation)
+                    return;
+                if (slots_[index].active.exchange(false, std::memory_order_acq_rel))
+                {
+                    active_.fetch_sub(1, std::memory_order_relaxed);
+                    free_.push_back(index);
+                }
+            }
+
+            bool empty() const { return active_.load(std::memory_order_relaxed) == 0; }
+
+            template <typename F>
+            void forEach(F&& func) const
+            {
+                for (const auto& slot : slots_)
+                {
+                    if (slot.active.load(std::memory_order_acquire))
+                        func(slot.callback);
+                }
+            }
+        };
+    }
+
+    template <typename T, typename SyncPolicy = typename detail::state_sync<T>::type>
+    class LayerState
+    {
+    private:
+        friend class LayerStateRegistry;
+
+        using Sync      = detail::StateSync<SyncPolicy>;
+        using WriteLock = typename Sync::WriteLock;
+        using Storage   = typename detail::state_storage<T>::type;
+        using Data      = detail::StateData<T, Storage>;
+
+        static constexpr bool kDeferred = std::is_same_v<typename detail::state_notify<T>::type, notify::Deferred>;
+
+        // Shared with ObserverDispatcher so a queued notification can outlive the state
+        class DeferredNotification final : public detail::PendingNotification
+        {
+        private:
+            std::mutex     mutex_;
+            LayerState<T>* state_;
+
+        public:
+            explicit DeferredNotification(LayerState<T>* state)
+                : state_(state) {}
+
+            void deliver() override
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (state_)
+                    state_->deliverSnapshot();
+            }
+
+            void detach()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                state_ = nullptr;
+            }
+        };
+
+        Sync                                     sync_;
+        Data                                     data_;
+        std::shared_ptr<detail::ObserverList<T>> observers_; // Allocated by the first addObserver()
+        std::shared_ptr<DeferredNotification>    deferred_;
+
+    public:
+        class Proxy
+        {
+        private:
+            LayerState<T>&      state_;
+            WriteLock           lock_;
+            typename Data::Lock shared_;
+
+        public:
+            Proxy(LayerState<T>& state)
+                : state_(state), lock_(state_.sync_.lockWrite()), shared_(state_.data_.lock()) {}
+            ~Proxy() { state_.notifyObservers(); }
+
+            T*       operator->() { return &state_.data_.get(); }
+            const T* operator->() const { return &state_.data_.get(); }
+        };
+
+        LayerState()
+        {
+            if constexpr (kDeferred)
+                deferred_ = std::make_shared<DeferredNotification>(this);
+        }
+
+        ~LayerState()
+        {
+            if constexpr (kDeferred)
+                deferred_->detach();
+        }
+
+        LayerState(const LayerState&)            = delete;
+        LayerState& operator=(const LayerState&) = delete;
+
+        Proxy access() { return Proxy(*this); }
+
+        T read() const
+        {
+            [[maybe_unused]] auto shared = data_.lock();
+            return sync_.read(data_.get());
+        }
+
+        void write(const T& newData)
+        {
+            auto                  lock   = sync_.lockWrite();
+            [[maybe_unused]] auto shared = data_.lock();
+            data_.get()                  = newData;
+            notifyObservers();
+        }
+
+        template <typename F>
+        void modify(F&& func)
+        {
+            auto                  lock   = sync_.lockWrite();
+            [[maybe_unused]] auto shared = data_.lock();
+            func(data_.get());
+            notifyObservers();
+        }
+
+        /// @brief Registers @p observer, which must fit util::InplaceFunction's buffer
+        ObserverSubscription addObserver(typename detail::ObserverList<T>::Callback observer)
+        {
+            auto lock = sync_.lockWrite();
+            if (!observers_)
+                observers_ = std::make_shared<detail::ObserverList<T>>();
+
+            auto [index, generation] = observers_->add(std::move(observer));
+            return ObserverSubscription(observers_, index, generation);
+        }
+
+    private:
+        bool hasObservers() const { return observers_ && !observers_->empty(); }
+
+        void notifyObservers()
+        {
+            if (!hasObservers())
+                return;
+
+            if constexpr (kDeferred)
+                ObserverDispatcher::GetInstance().schedule(deferred_);
+            else
+                observers_->forEach([this](const auto& observer) { observer(data_.get()); });
+        }
+
+        // Runs on the dispatcher; observers see a copy taken after the latest modification
+        void deliverSnapshot()
+        {
+            std::vector<typename detail::ObserverList<T>::Callback> observers;
+            std::optional<T>                                        snapshot;
+            {
+                auto                  lock   = sync_.lockWrite();
+                [[maybe_unused]] auto shared = data_.lock();
+                if (!hasObservers())
+                    return;
+                observers_->forEach([&observers](const auto& observer) { observers.push_back(observer); });
+                snapshot.emplace(data_.get());
+            }
+
+            for (const auto& observer : observers)
+            {
+                observer(*snapshot);
+            }
+        }
+    };
+
+    namespace detail
+    {
+        template <typename>
+        struct member_pointer_traits;
+
+        template <typename C, typename F>
+        struct member_pointer_traits<F C::*>
+        {
+            using Class = C;
+            using Field = F;
+        };
+
+        template <auto Value>
+        struct constant_tag {};
+
+        template <auto Member, auto... Fields>
+        constexpr std::size_t field_index()
+        {
+            constexpr bool matches[] = { std::is_same_v<constant_tag<Member>, constant_tag<Fields>>... };
+            for (std::size_t i = 0; i < sizeof...(Fields); ++i)
+            {
+                if (matches[i])
+                    return i;
+            }
+            return sizeof...(Fields);
+        }
+    }
+
+    /// @brief LayerState for types selecting sync::Atomic<&T::field...>
+    template <typename T, auto... Fields>
+    class LayerState<T, sync::Atomic<Fields...>>
+    {
+        static_assert(sizeof...(Fields) > 0, "sync::Atomic requires at least one field");
+        static_assert(!std::is_same_v<typename detail::state_storage<T>::type, storage::Mapped>,
+            "sync::Atomic states cannot use storage::Mapped");
+        static_assert(!std::is_same_v<typename detail::state_storage<T>::type, storage::Shared>,
+            "sync::Atomic states cannot use storage::Shared");
+        static_assert((std::is_same_v<typename detail::member_pointer_traits<decltype(Fields)>::Class, T> && ...),
+            "sync::Atomic fields must be data members of the state type");
+        static_assert((std::atomic<typename detail::member_pointer_traits<decltype(Fields)>::Field>::is_always_lock_free && ...),
+            "sync::Atomic fields must be lock-free atomic types");
+
+    private:
+        template <auto Member>
+        using FieldType = typename detail::member_pointer_traits<decltype(Member)>::Field;
+
+        std::tuple<std::atomic<FieldType<Fields>>...> fields_;
+
+        template <auto Member>
+        std::atomic<FieldType<Member>>& field()
+        {
+            constexpr auto index = detail::field_index<Member, Fields...>();
+            static_assert(index < sizeof...(Fields), "Member is not listed in sync::Atomic");
+            return std::get<index>(fields_);
+        }
+
+        template <auto Member>
+        const std::atomic<FieldType<Member>>& field() const
+        {
+            return const_cast<LayerState*>(this)->template field<Member>();
+        }
+
+    public:
+        LayerState()
+        {
+            write(T {});
+        }
+
+        LayerState(const LayerState&)            = delete;
+        LayerState& operator=(const LayerState&) = delete;
+
+        T read() const
+        {
+            T result {};
+            ((result.*Fields = field<Fields>().load(std::memory_order_relaxed)), ...);
+            return result;
+        }
+
+        void write(const T& newData)
+        {
+            (field<Fields>().store(newData.*Fields, std::memory_order_relaxed), ...);
+        }
+
+        template <auto Member>
+        FieldType<Member> load() const
+        {
+            return field<Member>().load(std::memory_order_relaxed);
+        }
+
+        template <auto Member>
+        void store(FieldType<Member> value)
+        {
+            field<Member>().store(value, std::memory_order_relaxed);
+        }
+
+        template <auto Member>
+        FieldType<Member> exchange(FieldType<Member> value)
+        {
+            return field<Member>().exchange(value, std::memory_order_relaxed);
+        }
+
+        template <auto Member>
+        FieldType<Member> fetch_add(FieldType<Member> delta)
+        {
+            return field<Member>().fetch_add(delta, std::memory_order_relaxed);
+        }
+
+        template <auto Member>
+        FieldType<Member> fetch_sub(FieldType<Member> delta)
+        {
+            return field<Member>().fetch_sub(delta, std::memory_order_relaxed);
+        }
+    };
+
+    /// @brief Interned context name
+    ///
+    /// Ids handed out by InternContext() stay valid for the lifetime of the
+    /// process, including across LayerStateRegistry::Clear(). Contexts only
+    /// named through forContext() or ScopedContext are transient: their id is
+    /// recycled once no state and no scope refers to them anymore.
+    struct ContextId
+    {
+        std::uint32_t value = 0;
+
+        friend bool operator==(ContextId lhs, ContextId rhs) { return lhs.value == rhs.value; }
+        friend bool operator!=(ContextId lhs, ContextId rhs) { return lhs.value != rhs.value; }
+    };
+
+    /// @brief Id of the "global" context
+    inline constexpr ContextId kGlobalContext {};
+
+    namespace detail
+    {
+        inline std::size_t NextStateTypeId()
+        {
+            static std::atomic<std::size_t> next { 0 };
+            return next.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// @brief Dense slot of a storage type in the registry, assigned on first use
+        template <typename State>
+        struct StateTypeId
+        {
+            static inline const std::size_t value = NextStateTypeId();
+        };
+
+        /// @brief Registry-owned free-list pool backing the states of one storage type
+        ///
+        /// States are allocate_shared() into fixed-size chunks carved from large
+        /// blocks, so a type's states sit next to each other and creating one takes
+        /// no trip to the global heap. A freed chunk goes back on the free list for
+        /// the next state; blocks are only released with the pool, which every
+        /// state keeps alive through its allocator.
+        class StatePool
+        {
+        private:
+            static constexpr std::size_t kChunksPerBlock = 64;
+
+            struct FreeChunk
+            {
+                FreeChunk* next;
+            };
+
+            SpinLock           lock_;
+            std::size_t        chunkSize_  = 0;
+            std::size_t        chunkAlign_ = alignof(FreeChunk);
+            FreeChunk*         free_       = nullptr;
+            std::vector<void*> blocks_;
+
+            // Requests larger than the first one never occur for a single state type
+            bool pooled(std::size_t size, std::size_t alignment) const { return size <= chunkSize_ && alignment <= chunkAlign_; }
+
+            void grow()
+            {
+                auto block = static_cast<std::byte*>(::operator new(chunkSize_ * kChunksPerBlock, std::align_val_t(chunkAlign_)));
+                blocks_.push_back(block);
+                for (std::size_t i = kChunksPerBlock; i-- > 0;)
+                    free_ = ::new (block + i * chunkSize_) FreeChunk { free_ };
+            }
+
+        public:
+            StatePool() = default;
+            ~StatePool()
+            {
+                for (void* block : blocks_)
+                    ::operator delete(block, std::align_val_t(chunkAlign_));
+            }
+
+            StatePool(const StatePool&)            = delete;
+            StatePool& operator=(const StatePool&) = delete;
+
+            void* allocate(std::size_t size, std::size_t alignment)
+            {
+                std::lock_guard<SpinLock> lock(lock_);
+                if (chunkSize_ == 0)
+                {
+                    chunkAlign_ = std::max(alignment, alignof(FreeChunk));
+                    chunkSize_  = (std::max(size, sizeof(FreeChunk)) + chunkAlign_ - 1) / chunkAlign_ * chunkAlign_;
+                }
+                if (!pooled(size, alignment))
+                    return ::operator new(size, std::align_val_t(alignment));
+
+                if (!free_)
+                    grow();
+                FreeChunk* chunk = free_;
+                free_            = chunk->next;
+                return chunk;
+            }
+
+            void deallocate(void* ptr, std::size_t size, std::size_t alignment)
+            {
+                std::lock_guard<SpinLock> lock(lock_);
+                if (!pooled(size, alignment))
+                {
+                    ::operator delete(ptr, std::align_val_t(alignment));
+                    return;
+                }
+                free_ = ::new (ptr) FreeChunk { free_ };
+            }
+        };
+
+        /// @brief Allocator handing allocate_shared() chunks of a StatePool
+        template <typename U>
+        struct StatePoolAllocator
+        {
+            using value_type = U;
+
+            std::shared_ptr<StatePool> pool;
+
+            explicit StatePoolAllocator(std::shared_ptr<StatePool> statePool)
+                : pool(std::move(statePool)) {}
+
+            template <typename V>
+            StatePoolAllocator(const StatePoolAllocator<V>& other)
+                : pool(other.pool) {}
+
+            U*   allocate(std::size_t n) { return static_cast<U*>(pool->allocate(n * sizeof(U), alignof(U))); }
+            void deallocate(U* ptr, std::size_t n) { pool->deallocate(ptr, n * sizeof(U), alignof(U)); }
+
+            template <typename V>
+            friend bool operator==(const StatePoolAllocator& lhs, const StatePoolAllocator<V>& rhs) { return lhs.pool == rhs.pool; }
+
+            template <typename V>
+            friend bool operator!=(const StatePoolAllocator& lhs, const StatePoolAllocator<V>& rhs) { return lhs.pool != rhs.pool; }
+        };
+
+        /// @brief Immutable view of one storage type's states
+        ///
+        /// Built under the registry lock and then traversed without it. Each
+        /// entry keeps its state alive, so a later Clear() or eviction does not
+        /// pull states out from under a running traversal.
+        struct StateSnapshot
+        {
+            struct Entry
+            {
+                std::shared_ptr<const std::string> context;
+                std::shared_ptr<const void>        state;
+            };
+
+            std::vector<Entry> entries;
+        };
+
+        struct AppendTo
+        {
+            std::vector<std::byte>& buffer;
+
+            void operator()(const void* data, std::size_t size) const
+            {
+                auto bytes = static_cast<const std::byte*>(data);
+                buffer.insert(buffer.end(), bytes, bytes + size);
+            }
+        };
+
+        template <typename State>
+        struct storage_of
+        {
+            using type = storage::Inline;
+        };
+
+        template <typename T, typename SyncPolicy>
+        struct storage_of<LayerState<T, SyncPolicy>>
+        {
+            using type = typename state_storage<T>::type;
+        };
+
+        template <typename State>
+        struct evictable_state : std::false_type
+        {
+        };
+
+        template <typename T, typename SyncPolicy>
+        struct evictable_state<LayerState<T, SyncPolicy>> : std::is_same<typename state_lifetime<T>::type, lifetime::Evictable>
+        {
+            using type = T;
+        };
+
+        template <typename State>
+        struct exportable_state : std::false_type
+        {
+        };
+
+        template <typename T, typename SyncPolicy>
+        struct exportable_state<LayerState<T, SyncPolicy>> : std::is_trivially_copyable<T>
+        {
+            using type = T;
+        };
+    }
+
+    /// @brief Section header of a binary state export
+    ///
+    /// A section is this header, typeNameSize bytes of type name, then count
+    /// records of { uint32_t contextSize, context bytes, stateSize bytes of T }.
+    /// The type name is the readable, unmangled one, so it matches across compilers.
+    /// Records are packed, read them with memcpy. All fields are host byte order.
+    /// Padding bytes inside T are copied as-is and carry no meaning.
+    struct StateExportHeader
+    {
+        static constexpr std::uint32_t kMagic   = 0x53525453; // "STRS"
+        static constexpr std::uint32_t kVersion = 2;
+
+        std::uint32_t magic        = kMagic;
+        std::uint32_t version      = kVersion;
+        std::uint32_t stateSize    = 0;
+        std::uint32_t count        = 0;
+        std::uint32_t typeNameSize = 0;
+    };
+
+    /// @brief Sink for streamed exports, called with consecutive chunks of the output
+    using StateExportWriter = std::function<void(const void*, std::size_t)>;
+
+    /// @brief Bounds on the states of a lifetime::Evictable type
+    ///
+    /// Recency is tracked with a CLOCK (second chance) approximation of LRU:
+    /// registry lookups and every LayerStateHandle access mark a state as
+    /// referenced, and sweeps only evict states not referenced since the last
+    /// pass. Capacity is enforced when a new state is created. Expiry runs at
+    /// most every ttl / 4 on creation and on LayerStateManager<T>::evictExpired().
+    template <typename T>
+    struct StateEvictionPolicy
+    {
+        std::size_t                         maxStates = 0;  // 0 for no limit
+        std::chrono::steady_clock::duration ttl       = {}; // Idle time before expiry, zero for none
+
+        /// @brief Called with the context and final value of each evicted state, outside the registry lock
+        std::function<void(const std::string&, const T&)> onEvict;
+    };
+
+    namespace detail
+    {
+        // Written by handles without the registry lock, hence atomic
+        struct EvictionMarks
+        {
+            std::atomic<bool> referenced { true };
+            std::atomic<bool> evicted { false };
+        };
+
+        template <typename State>
+        struct EvictableEntry : EvictionMarks
+        {
+            State                                 state;
+            std::uint32_t                         context = 0;
+            std::size_t                           index   = 0;
+            std::chrono::steady_clock::time_point lastUsed;
+        };
+
+        class EvictionStoreBase
+        {
+        public:
+            virtual ~EvictionStoreBase() = default;
+            virtual void clear()         = 0;
+        };
+
+        /// @brief Live states of one evictable type in clock order, guarded by the registry lock
+        template <typename T>
+        class EvictionStore final : public EvictionStoreBase
+        {
+        public:
+            using Entry = EvictableEntry<LayerState<T>>;
+
+            StateEvictionPolicy<T>                policy;
+            std::vector<std::shared_ptr<Entry>>   entries;
+            std::size_t                           hand = 0;
+            std::chrono::steady_clock::time_point lastExpiry;
+
+            void add(std::shared_ptr<Entry> entry)
+            {
+                entry->index = entries.size();
+                entries.push_back(std::move(entry));
+            }
+
+            void removeAt(std::size_t index)
+            {
+                if (index + 1 != entries.size())
+                {
+                    entries[index]        = std::move(entries.back());
+                    entries[index]->index = index;
+                }
+                entries.pop_back();
+            }
+
+            void clear() override
+            {
+                for (const auto& entry : entries)
+                    entry->evicted.store(true, std::memory_order_release);
+                entries.clear();
+                hand = 0;
+            }
+        };
+    }
+
+    namespace detail
+    {
+        /// @brief Read-write view of a file or named shared-memory object
+        class MappedRegion
+        {
+        private:
+            std::byte*  base_ = nullptr;
+            std::size_t size_ = 0;
+
+            MappedRegion(std::byte* base, std::size_t size)
+                : base_(base), size_(size) {}
+
+#if defined(_WIN32)
+            static MappedRegion MapView(HANDLE mapping, std::size_t size, const std::string& name)
+            {
+                if (!mapping)
+                    throw std::runtime_error("MappedRegion: cannot map " + name);
+                auto view = static_cast<std::byte*>(::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+                ::CloseHandle(mapping);
+                if (!view)
+                    throw std::runtime_error("MappedRegion: cannot map " + name);
+                return MappedRegion(view, size);
+            }
+#else
+            // Grows the object to at least capacity and maps all of it
+            static MappedRegion MapDescriptor(int fd, std::size_t capacity, const std::string& name)
+            {
+                struct stat info {};
+                if (::fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) < capacity)
+                    ::ftruncate(fd, static_cast<off_t>(capacity));
+
+                // Another process may have grown it further in the meantime
+                if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < capacity)
+                {
+                    ::close(fd);
+                    throw std::runtime_error("MappedRegion: cannot resize " + name);
+                }
+
+                const auto size = static_cast<std::size_t>(info.st_size);
+                void*      view = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                ::close(fd);
+                if (view == MAP_FAILED)
+                    throw std::runtime_error("MappedRegion: cannot map " + name);
+                return MappedRegion(static_cast<std::byte*>(view), size);
+            }
+#endif
+
+        public:
+            static MappedRegion OpenFile(const std::string& path, std::size_t capacity)
+            {
+#if defined(_WIN32)
+                HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                    nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (file == INVALID_HANDLE_VALUE)
+                    throw std::runtime_error("MappedRegion: cannot open " + path);
+
+                LARGE_INTEGER existing {};
+                ::GetFileSizeEx(file, &existing);
+                const std::size_t size = (std::max)(static_cast<std::size_t>(existing.QuadPart), capacity);
+
+                HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(std::uint64_t { size } >> 32),
+                    static_cast<DWORD>(size & 0xFFFFFFFFu), nullptr);
+                ::CloseHandle(file);
+                return MapView(mapping, size, path);
+#else
+                int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+                if (fd < 0)
+                    throw std::runtime_error("MappedRegion: cannot open " + path);
+                return MapDescriptor(fd, capacity, path);
+#endif
+            }
+
+            static MappedRegion OpenShared(const std::string& name, std::size_t capacity)
+            {
+#if defined(_WIN32)
+                HANDLE mapping = ::CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                    static_cast<DWORD>(std::uint64_t { capacity } >> 32), static_cast<DWORD>(capacity & 0xFFFFFFFFu), name.c_str());
+                return MapView(mapping, capacity, name);
+#else
+                const std::string object = name.empty() || name[0] != '/' ? "/" + name : name;
+                int               fd     = ::shm_open(object.c_str(), O_RDWR | O_CREAT, 0600);
+                if (fd < 0)
+                    throw std::runtime_error("MappedRegion: cannot open shared memory " + name);
+                return MapDescriptor(fd, capacity, name);
+#endif
+            }
+
+            static void RemoveShared(const std::string& name)
+            {
+#if !defined(_WIN32)
+                const std::string object = name.empty() || name[0] != '/' ? "/" + name : name;
+                ::shm_unlink(object.c_str());
+#else
+                (void)name; // Released with the last view
+#endif
+            }
+
+
+            MappedRegion(MappedRegion&& other) noexcept
+                : base_(std::exchange(other.base_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+            MappedRegion(const MappedRegion&)            = delete;
+            MappedRegion& operator=(const MappedRegion&) = delete;
+            MappedRegion& operator=(MappedRegion&&)      = delete;
+
+            ~MappedRegion()
+            {
+                if (!base_)
+                    return;
+#if defined(_WIN32)
+                ::UnmapViewOfFile(base_);
+#else
+                ::munmap(base_, size_);
+#endif
+            }
+
+            std::byte*  data() const { return base_; }
+            std::size_t size() const { return size_; }
+
+            void flush()
+            {
+#if defined(_WIN32)
+                ::FlushViewOfFile(base_, size_);
+#else
+                ::msync(base_, size_, MS_SYNC);
+#endif
+            }
+        };
+
+        /// @brief Record layout shared by MappedStateFile and SharedStateSegment
+        ///
+        /// A record is this header, the type name and context bytes, then the
+        /// payload at dataOffset. Records are padded to kAlignment and never move.
+        struct StateRecord
+        {
+            static constexpr std::size_t kAlignment = 64;
+
+            static constexpr std::size_t AlignUp(std::size_t value) { return (value + kAlignment - 1) & ~(kAlignment - 1); }
+
+            std::uint64_t size;
+            std::uint32_t stateSize;
+            std::uint32_t typeNameSize;
+            std::uint32_t contextSize;
+            std::uint32_t dataOffset;
+
+            static std::string Key(std::string_view typeName, std::string_view context)
+            {
+                std::string key;
+                key.reserve(typeName.size() + context.size() + 1);
+                key.append(typeName).push_back('\0');
+                key.append(context);
+                return key;
+            }
+
+            static StateRecord Make(std::string_view typeName, std::string_view context, std::size_t payloadSize, std::uint32_t stateSize)
+            {
+                StateRecord record {};
+                record.stateSize    = stateSize;
+                record.typeNameSize = static_cast<std::uint32_t>(typeName.size());
+                record.contextSize  = static_cast<std::uint32_t>(context.size());
+                record.dataOffset   = static_cast<std::uint32_t>(AlignUp(sizeof(StateRecord) + typeName.size() + context.size()));
+                record.size         = AlignUp(record.dataOffset + payloadSize);
+                return record;
+            }
+
+            static void Write(std::byte* at, const StateRecord& record, std::string_view typeName, std::string_view context)
+            {
+                std::memcpy(at, &record, sizeof(record));
+                std::memcpy(at + sizeof(record), typeName.data(), typeName.size());
+                std::memcpy(at + sizeof(record) + typeName.size(), context.data(), context.size());
+            }
+
+            /// @brief Indexes valid records in [offset, end), returns where the scan stopped
+            template <typename Index>
+            static std::size_t Scan(const std::byte* base, std::size_t offset, std::size_t end, Index& index)
+            {
+                while (offset + sizeof(StateRecord) <= end)
+                {
+                    StateRecord record;
+                    std::memcpy(&record, base + offset, sizeof(record));
+                    if (record.size == 0 || record.size > end - offset
+                        || std::size_t { record.dataOffset } + record.stateSize > record.size
+                        || sizeof(StateRecord) + std::size_t { record.typeNameSize } + record.contextSize > record.dataOffset)
+                        break;
+
+                    auto names = reinterpret_cast<const char*>(base + offset + sizeof(StateRecord));
+                    index[Key({ names, record.typeNameSize }, { names + record.typeNameSize, record.contextSize })] = offset;
+                    offset += static_cast<std::size_t>(record.size);
+                }
+                return offset;
+            }
+        };
+
+        /// @brief Spin lock on a word in shared memory, usable across processes
+        ///
+        /// Lock-free std::atomic operations are address-free, so each process may
+        /// map the word at a different address. A null word means no locking.
+        class SharedLockGuard
+        {
+        private:
+            std::atomic<std::uint32_t>* word_;
+
+        public:
+            explicit SharedLockGuard(std::atomic<std::uint32_t>* word)
+                : word_(word)
+            {
+                if (!word_)
+                    return;
+                while (word_->exchange(1, std::memory_order_acquire) != 0)
+                {
+                    while (word_->load(std::memory_order_relaxed) != 0)
+                        std::this_thread::yield();
+                }
+            }
+
+            ~SharedLockGuard()
+            {
+                if (word_)
+                    word_->store(0, std::memory_order_release);
+            }
+
+            SharedLockGuard(const SharedLockGuard&)            = delete;
+            SharedLockGuard& operator=(const SharedLockGuard&) = delete;
+        };
+
+        template <typename T>
+        SharedLockGuard StateData<T, storage::Shared>::lock() const
+        {
+            return SharedLockGuard(lock_);
+        }
+
+        static_assert(std::atomic<std::uint32_t>::is_always_lock_free && std::atomic<std::uint64_t>::is_always_lock_free,
+            "Shared state segments require lock-free 32 and 64 bit atomics");
+    }
+
+    /// @brief Memory-mapped backing file for storage::Mapped states
+    ///
+    /// Records are appended once per (type, context) and never moved, so a
+    /// state points straight into the mapping. On open, the newest record of
+    /// each key is kept for adoption. The first state created for that key in
+    /// this process takes the record over, and later ones (after Clear() or
+    /// removeState()) start from a fresh record. The record count only becomes
+    /// visible after a record is fully written, so a crash mid-append loses
+    /// only that record. Once the file is full, new states fall back to
+    /// inline storage.
+    class MappedStateFile
+    {
+    private:
+        static constexpr std::uint32_t kMagic   = 0x4D525453; // "STRM"
+        static constexpr std::uint32_t kVersion = 1;
+
+        struct FileHeader
+        {
+            std::uint32_t magic;
+            std::uint32_t version;
+            std::uint64_t used;
+        };
+
+        static constexpr std::size_t kDataStart = detail::StateRecord::AlignUp(sizeof(FileHeader));
+
+        detail::MappedRegion                         region_;
+        std::mutex                                   mutex_;
+        std::unordered_map<std::string, std::size_t> adoptable_;
+
+        FileHeader& header() { return *reinterpret_cast<FileHeader*>(region_.data()); }
+
+        void load()
+        {
+            auto& file = header();
+            if (file.magic != kMagic || file.version != kVersion || file.used < kDataStart || file.used > region_.size())
+            {
+                file = FileHeader { kMagic, kVersion, kDataStart };
+                return;
+            }
+
+            // A record that does not fit ends the scan and is overwritten by the next append
+            file.used = detail::StateRecord::Scan(region_.data(), kDataStart, static_cast<std::size_t>(file.used), adoptable_);
+        }
+
+    public:
+        /// @brief Opens or creates @p path, growing it to at least @p capacity bytes
+        explicit MappedStateFile(const std::string& path, std::size_t capacity = std::size_t { 1 } << 20)
+            : region_(detail::MappedRegion::OpenFile(path, (std::max)(capacity, kDataStart)))
+        {
+            load();
+        }
+
+        /// @brief Record for (typeName, context), or nullptr once the file is full
+        ///
+        /// Returns the previous process's record on first use of a key, otherwise
+        /// appends a record holding a default-constructed T.
+        template <typename T>
+        T* claim(std::string_view typeName, std::string_view context)
+        {
+            static_assert(alignof(T) <= detail::StateRecord::kAlignment, "Mapped state types must not be over-aligned");
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto                        it = adoptable_.find(detail::StateRecord::Key(typeName, context));
+            if (it != adoptable_.end())
+            {
+                const std::size_t offset = it->second;
+                adoptable_.erase(it);
+
+                detail::StateRecord record;
+                std::memcpy(&record, region_.data() + offset, sizeof(record));
+                if (record.stateSize == sizeof(T))
+                    return std::launder(reinterpret_cast<T*>(region_.data() + offset + record.dataOffset));
+            }
+
+            auto  record = detail::StateRecord::Make(typeName, context, sizeof(T), static_cast<std::uint32_t>(sizeof(T)));
+            auto& file   = header();
+            if (record.size > region_.size() - file.used)
+                return nullptr;
+
+            std::byte* at = region_.data() + file.used;
+            detail::StateRecord::Write(at, record, typeName, context);
+            T* state = new (at + record.dataOffset) T();
+            file.used += record.size;
+            return state;
+        }
+
+        /// @brief Writes dirty pages back to the file
+        void flush() { region_.flush(); }
+
+        std::size_t capacity() const { return region_.size(); }
+    };
+
+    /// @brief Named shared-memory segment backing storage::Shared states host-wide
+    ///
+    /// Every process that opens the same name sees one record per (type, context),
+    /// so workers of a pre-fork server update a single view without IPC. Each
+    /// record carries a process-shared spin lock that LayerState takes around
+    /// every access in addition to its in-process Sync policy. Appends are
+    /// serialized by a lock in the segment header, and other processes pick
+    /// new records up lazily on their next miss.
+    ///
+    /// A process that dies while holding a record lock leaves that record
+    /// locked; remove the segment before restarting the workers in that case.
+    class SharedStateSegment
+    {
+    private:
+        static constexpr std::uint32_t kMagic   = 0x48525453; // "STRH"
+        static constexpr std::uint32_t kVersion = 1;
+
+        enum : std::uint32_t
+        {
+            kUninitialized = 0,
+            kInitializing  = 1,
+            kReady         = 2
+        };
+
+        struct SegmentHeader
+        {
+            std::atomic<std::uint32_t> state;
+            std::atomic<std::uint32_t> lock;
+            std::uint32_t              magic;
+            std::uint32_t              version;
+            std::uint64_t              capacity;
+            std::atomic<std::uint64_t> used;
+        };
+
+        static constexpr std::size_t kDataStart = detail::StateRecord::AlignUp(sizeof(SegmentHeader));
+
+        detail::MappedRegion                         region_;
+        std::mutex                                   mutex_;
+        std::unordered_map<std::string, std::size_t> index_;
+        std::size_t                                  scanned_ = kDataStart;
+
+        SegmentHeader& header() { return *std::launder(reinterpret_cast<SegmentHeader*>(region_.data())); }
+
+        // Zero-filled memory is a valid unlocked header, the first opener fills in the rest
+        void initialize()
+        {
+            auto&         segment  = header();
+            std::uint32_t expected = kUninitialized;
+            if (segment.state.compare_exchange_strong(expected, kInitializing, std::memory_order_acquire))
+            {
+                segment.magic    = kMagic;
+                segment.version  = kVersion;
+                segment.capacity = region_.size();
+                segment.used.store(kDataStart, std::memory_order_relaxed);
+                segment.state.store(kReady, std::memory_order_release);
+                return;
+            }
+
+            while (segment.state.load(std::memory_order_acquire) != kReady)
+                std::this_thread::yield();
+            if (segment.magic != kMagic || segment.version != kVersion)
+                throw std::runtime_error("SharedStateSegment: incompatible segment layout");
+        }
+
+        template <typename T>
+        static constexpr std::size_t LockSpace()
+        {
+            return (std::max)(alignof(T), sizeof(std::atomic<std::uint32_t>));
+        }
+
+    public:
+        /// @brief Reference to a record's state and its process-shared lock
+        template <typename T>
+        struct Slot
+        {
+            T*                          data = nullptr;
+            std::atomic<std::uint32_t>* lock = nullptr;
+        };
+
+        /// @brief Opens or creates the segment @p name, every process should pass the same capacity
+        explicit SharedStateSegment(const std::string& name, std::size_t capacity = std::size_t { 1 } << 20)
+            : region_(detail::MappedRegion::OpenShared(name, (std::max)(capacity, kDataStart)))
+        {
+            initialize();
+        }
+
+        /// @brief Unlinks the segment name, existing mappings stay valid
+        static void Remove(const std::string& name) { detail::MappedRegion::RemoveShared(name); }
+
+        /// @brief The host-wide record for (typeName, context), empty once the segment is full
+        template <typename T>
+        Slot<T> claim(std::string_view typeName, std::string_view context)
+        {
+            static_assert(alignof(T) <= detail::StateRecord::kAlignment, "Shared state types must not be over-aligned");
+
+            const std::string           key = detail::StateRecord::Key(typeName, context);
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto&                       segment = header();
+            const std::size_t           limit   = (std::min)(static_cast<std::size_t>(segment.capacity), region_.size());
+
+            auto it = index_.find(key);
+            if (it == index_.end())
+            {
+                detail::SharedLockGuard append(&segment.lock);
+                scanned_ = detail::StateRecord::Scan(region_.data(), scanned_, static_cast<std::size_t>(segment.used.load(std::memory_order_acquire)), index_);
+                it       = index_.find(key);
+
+                if (it == index_.end())
+                {
+                    const std::size_t used   = static_cast<std::size_t>(segment.used.load(std::memory_order_relaxed));
+                    auto              record = detail::StateRecord::Make(typeName, context, LockSpace<T>() + sizeof(T), static_cast<std::uint32_t>(sizeof(T)));
+                    if (record.size > limit - used)
+                        return {};
+
+                    std::byte* at = region_.data() + used;
+                    detail::StateRecord::Write(at, record, typeName, context);
+                    new (at + record.dataOffset) std::atomic<std::uint32_t>(0);
+                    new (at + record.dataOffset + LockSpace<T>()) T();
+                    segment.used.store(used + record.size, std::memory_order_release);
+
+                    scanned_ = used + static_cast<std::size_t>(record.size);
+                    it       = index_.emplace(key, used).first;
+                }
+            }
+
+            detail::StateRecord record;
+            std::memcpy(&record, region_.data() + it->second, sizeof(record));
+            if (record.stateSize != sizeof(T))
+                throw std::runtime_error("SharedStateSegment: state size mismatch for " + std::string(typeName));
+
+            std::byte* payload = region_.data() + it->second + record.dataOffset;
+            return { std::launder(reinterpret_cast<T*>(payload + LockSpace<T>())),
+                std::launder(reinterpret_cast<std::atomic<std::uint32_t>*>(payload)) };
+        }
+
+        std::size_t capacity() const { return region_.size(); }
+    };
+
+    class LayerStateRegistry
+    {
+        template <typename T>
+        friend class LayerStateManager;
+
+        template <typename T>
+        friend class LayerStateHandle;
+
+    public:
+        static void Clear() { GetInstance().clear(); }
+
+        /// @brief Select the calling thread's current context, "global" until set
+        static void setCurrentContext(const std::string& context) { currentContext = InternContext(context); }
+        static void setCurrentContext(ContextId context) { currentContext = context; }
+
+        static const std::string& getCurrentContext() { return GetContextName(currentContext); }
+        static ContextId          getCurrentContextId() { return currentContext; }
+
+        static ContextId          InternContext(const std::string& context) { return GetInstance().internContext(context); }
+
+        /// @brief Interns @p context for as long as it is pinned, see ScopedContext
+        static ContextId PinContext(const std::string& context) { return GetInstance().pinContext(context); }
+        static void      UnpinContext(ContextId context) { GetInstance().unpinContext(context); }
+        static const std::string& GetContextName(ContextId id) { return GetInstance().contextName(id); }
+
+        /// @brief Backs storage::Mapped states created from now on with @p file, nullptr detaches
+        static void AttachMappedFile(std::shared_ptr<MappedStateFile> file) { GetInstance().attachMappedFile(std::move(file)); }
+
+        /// @brief Backs storage::Shared states created from now on with @p segment, nullptr detaches
+        static void AttachSharedSegment(std::shared_ptr<SharedStateSegment> segment) { GetInstance().attachSharedSegment(std::move(segment)); }
+
+        /// @brief Binary export of all trivially copyable state types, see StateExportHeader
+        static void                   ExportAll(const StateExportWriter& writer) { GetInstance().exportAll(writer); }
+        static std::vector<std::byte> ExportAll() { return GetInstance().exportAll(); }
+
+    private:
+        struct ContextEntry
+        {
+            std::shared_ptr<const std::string> name;
+            std::uint32_t                      states    = 0; // Live slots across all state types
+            std::uint32_t                      pins      = 0;
+            bool                               permanent = false;
+        };
+
+        // Trivially constructed, so switching contexts touches no allocation or TLS guard
+        static inline thread_local ContextId currentContext = kGlobalContext;
+        static LayerStateRegistry&           GetInstance()
+        {
+            static LayerStateRegistry instance;
+            return instance;
+        }
+
+        LayerStateRegistry()
+            : contexts_ { { std::make_shared<const std::string>("global"), 0, 0, true } }, contextIds_ { { "global", kGlobalContext.value } } {}
+
+    public:
+        // States are keyed by their storage type so LayerState<T> and
+        // ShardedLayerState<T> of the same T live side by side
+        template <typename T, typename State = LayerState<T>>
+        std::shared_ptr<State> getOrCreateState(const std::string& key)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto                         state = getOrCreateStateLocked<State>(internContextLocked(key, false));
+            runEvictions<State>(lock);
+            return state;
+        }
+
+        template <typename T, typename State = LayerState<T>>
+        std::shared_ptr<State> getOrCreateState(ContextId context)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto                         state = getOrCreateStateLocked<State>(context);
+            runEvictions<State>(lock);
+            return state;
+        }
+
+        /// @brief Raw lookup for cached handles, @p owner keeps the state alive
+        ///
+        /// For evictable types @p marks receives the state's eviction flags.
+        template <typename T, typename State = LayerState<T>>
+        State* resolveState(ContextId context, std::shared_ptr<const void>& owner, detail::EvictionMarks** marks = nullptr)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto                         state = getOrCreateStateLocked<State>(context, marks);
+            runEvictions<State>(lock);
+            owner = state;
+            return state.get();
+        }
+
+        template <typename T>
+        void setEvictionPolicy(StateEvictionPolicy<T> policy)
+        {
+            static_assert(detail::evictable_state<LayerState<T>>::value, "Eviction requires LayerStateTraits<T>::Lifetime = lifetime::Evictable");
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto&                        store = evictionStore<T>();
+            store.policy                       = std::move(policy);
+
+            const auto now = std::chrono::steady_clock::now();
+            evictOverflowLocked(store, 0, now);
+            expireLocked(store, now, true);
+            runEvictions<LayerState<T>>(lock);
+        }
+
+        /// @brief Evicts every state of T idle for longer than the policy's ttl
+        template <typename T>
+        void evictExpired()
+        {
+            static_assert(detail::evictable_state<LayerState<T>>::value, "Eviction requires LayerStateTraits<T>::Lifetime = lifetime::Evictable");
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            expireLocked(evictionStore<T>(), std::chrono::steady_clock::now(), true);
+            runEvictions<LayerState<T>>(lock);
+        }
+
+        void attachMappedFile(std::shared_ptr<MappedStateFile> file)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            mappedFile_ = std::move(file);
+        }
+
+        void attachSharedSegment(std::shared_ptr<SharedStateSegment> segment)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sharedSegment_ = std::move(segment);
+        }
+
+        ContextId internContext(const std::string& context)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return internContextLocked(context, true);
+        }
+
+        ContextId pinContext(const std::string& context)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto                        id = internContextLocked(context, false);
+            contexts_[id.value].pins++;
+            return id;
+        }
+
+        void unpinContext(ContextId id)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            contexts_[id.value].pins--;
+            releaseContextLocked(id.value);
+        }
+
+        const std::string& contextName(ContextId id)
+        {
+            // Names are heap-allocated, so references survive table growth while the context lives
+            std::lock_guard<std::mutex> lock(mutex_);
+            return *contexts_[id.value].name;
+        }
+
+        /// @brief Bumped whenever existing states are dropped, invalidating cached handles
+        std::uint64_t epoch() const { return epoch_.load(std::memory_order_acquire); }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Each dropped state is released by the last wrapper or handle still holding it
+            for (auto& byContext : slots_)
+                byContext.clear();
+            snapshots_.clear();
+            for (std::uint32_t id = 0; id < contexts_.size(); ++id)
+            {
+                if (contexts_[id].name)
+                {
+                    contexts_[id].states = 0;
+                    releaseContextLocked(id);
+                }
+            }
+            for (const auto& store : evictions_)
+            {
+                if (store)
+                    store->clear();
+            }
+            epoch_.fetch_add(1, std::memory_order_release);
+        }
+
+        void initialize()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slots_.reserve(16);
+        }
+
+        /// @brief Detaches the state of @p key, a new default state is created on next access
+        ///
+        /// Wrappers obtained earlier keep the detached state alive until they are released.
+        template <typename T>
+        void removeState(std::string_view key)
+        {
+            std::unique_lock lock(mutex_);
+            auto             idIt = contextIds_.find(std::string(key));
+            if (idIt != contextIds_.end())
+            {
+                const auto id   = idIt->second;
+                const auto type = detail::StateTypeId<LayerState<T>>::value;
+                if (type < slots_.size() && id < slots_[type].size() && slots_[type][id])
+                {
+                    if constexpr (detail::evictable_state<LayerState<T>>::value)
+                    {
+                        // Handles watch the entry's own flag, no epoch bump needed
+                        auto entry = static_cast<typename detail::EvictionStore<T>::Entry*>(slots_[type][id].get());
+                        evictLocked(evictionStore<T>(), entry->index, false);
+                        return;
+                    }
+                    slots_[type][id].reset();
+                    contexts_[id].states--;
+                }
+                if (type < snapshots_.size())
+                    snapshots_[type].reset();
+
+                // Bumped first, so handles of this context re-resolve before its id can come back
+                epoch_.fetch_add(1, std::memory_order_release);
+                releaseContextLocked(id);
+                return;
+            }
+            epoch_.fetch_add(1, std::memory_order_release);
+        }
+
+        /// @brief Visits every state of T without holding the registry lock
+        ///
+        /// The callback runs over a snapshot published by the last change to T's
+        /// states. Request threads keep creating and resolving states meanwhile;
+        /// states created after the snapshot was taken are not visited.
+        template <typename T>
+        void iterateStates(const std::function<void(const std::string&, const LayerState<T>&)>& func)
+        {
+            auto snapshot = snapshotStates<LayerState<T>>();
+            for (const auto& entry : snapshot->entries)
+                func(*entry.context, *static_cast<const LayerState<T>*>(entry.state.get()));
+        }
+
+        /// @brief Streams every state of T to @p writer as one StateExportHeader section
+        ///
+        /// Each state is copied once through read() and handed to the writer as
+        /// raw bytes, the registry lock is not held while writing.
+        template <typename T, typename Writer>
+        void exportStates(Writer&& writer)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Binary export requires a trivially copyable state type");
+
+            auto                       snapshot = snapshotStates<LayerState<T>>();
+            constexpr std::string_view typeName = detail::TypeName<T>();
+
+            StateExportHeader header;
+            header.stateSize    = static_cast<std::uint32_t>(sizeof(T));
+            header.count        = static_cast<std::uint32_t>(snapshot->entries.size());
+            header.typeNameSize = static_cast<std::uint32_t>(typeName.size());
+            writer(static_cast<const void*>(&header), sizeof(header));
+            writer(static_cast<const void*>(typeName.data()), typeName.size());
+
+            for (const auto& entry : snapshot->entries)
+            {
+                const T             value       = static_cast<const LayerState<T>*>(entry.state.get())->read();
+                const std::uint32_t contextSize = static_cast<std::uint32_t>(entry.context->size());
+                writer(static_cast<const void*>(&contextSize), sizeof(contextSize));
+                writer(static_cast<const void*>(entry.context->data()), std::size_t { contextSize });
+                writer(static_cast<const void*>(&value), sizeof(T));
+            }
+        }
+
+        template <typename T>
+        std::vector<std::byte> exportStates()
+        {
+            std::vector<std::byte> buffer;
+            exportStates<T>(detail::AppendTo { buffer });
+            return buffer;
+        }
+
+        /// @brief Exports one section per trivially copyable state type created so far
+        void exportAll(const StateExportWriter& writer)
+        {
+            std::vector<void (*)(LayerStateRegistry&, const StateExportWriter&)> exporters;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                exporters = exporters_;
+            }
+
+            for (auto exporter : exporters)
+            {
+                if (exporter)
+                    exporter(*this, writer);
+            }
+        }
+
+        std::vector<std::byte> exportAll()
+        {
+            std::vector<std::byte> buffer;
+            exportAll(detail::AppendTo { buffer });
+            return buffer;
+        }
+
+        template <typename State>
+        std::shared_ptr<const detail::StateSnapshot> snapshotStates()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto                        type = detail::StateTypeId<State>::value;
+            if (type >= snapshots_.size())
+                snapshots_.resize(type + 1);
+
+            auto& snapshot = snapshots_[type];
+            if (!snapshot)
+            {
+                // Writers only drop the published version, the next reader rebuilds it
+                auto next = std::make_shared<detail::StateSnapshot>();
+                if (type < slots_.size())
+                {
+                    const auto& byContext = slots_[type];
+                    for (std::size_t context = 0; context < byContext.size(); ++context)
+                    {
+                        if (byContext[context])
+                            next->entries.push_back({ contexts_[context].name, stateOf<State>(byContext[context]) });
+                    }
+                }
+                snapshot = std::move(next);
+            }
+            return snapshot;
+        }
+
+    private:
+        template <typename T, typename SyncPolicy>
+        void bindMapped(LayerState<T, SyncPolicy>& state, const std::string& context)
+        {
+            if (!mappedFile_)
+                return;
+            if (T* data = mappedFile_->claim<T>(detail::TypeName<T>(), context))
+                state.data_.bind(data, mappedFile_);
+        }
+
+        template <typename T, typename SyncPolicy>
+        void bindShared(LayerState<T, SyncPolicy>& state, const std::string& context)
+        {
+            if (!sharedSegment_)
+                return;
+            auto slot = sharedSegment_->claim<T>(detail::TypeName<T>(), context);
+            if (slot.data)
+                state.data_.bind(slot.data, slot.lock, sharedSegment_);
+        }
+
+        template <typename State>
+        static void ExportSection(LayerStateRegistry& registry, const StateExportWriter& writer)
+        {
+            registry.exportStates<typename detail::exportable_state<State>::type>(writer);
+        }
+
+        // Transient contexts are dropped by releaseContextLocked(), permanent ones never are
+        ContextId internContextLocked(const std::string& context, bool permanent)
+        {
+            auto [it, inserted] = contextIds_.try_emplace(context, 0);
+            if (inserted)
+            {
+                if (freeContexts_.empty())
+                {
+                    it->second = static_cast<std::uint32_t>(contexts_.size());
+                    contexts_.emplace_back();
+                }
+                else
+                {
+                    it->second = freeContexts_.back();
+                    freeContexts_.pop_back();
+                }
+                contexts_[it->second].name = std::make_shared<const std::string>(context);
+            }
+            contexts_[it->second].permanent |= permanent;
+            return ContextId { it->second };
+        }
+
+        // Recycles the id once nothing refers to the context, slot tables stay sized to the peak
+        void releaseContextLocked(std::uint32_t id)
+        {
+            auto& entry = contexts_[id];
+            if (entry.permanent || entry.states != 0 || entry.pins != 0)
+                return;
+            contextIds_.erase(*entry.name);
+            entry.name.reset();
+            freeContexts_.push_back(id);
+        }
+
+        std::shared_ptr<void>& slotLocked(std::size_t type, ContextId context)
+        {
+            if (type >= slots_.size())
+                slots_.resize(type + 1);
+
+            auto& byContext = slots_[type];
+            if (context.value >= byContext.size())
+                byContext.resize(std::max<std::size_t>(contexts_.size(), context.value + 1));
+            return byContext[context.value];
+        }
+
+        // Evictable slots own their entry, the state sits inside it
+        template <typename State>
+        static std::shared_ptr<State> stateOf(const std::shared_ptr<void>& slot)
+        {
+            if constexpr (detail::evictable_state<State>::value)
+            {
+                using T    = typename detail::evictable_state<State>::type;
+                auto entry = static_cast<typename detail::EvictionStore<T>::Entry*>(slot.get());
+                return std::shared_ptr<State>(slot, &entry->state);
+            }
+            else
+            {
+                return std::static_pointer_cast<State>(slot);
+            }
+        }
+
+        // Binds backing storage and publishes the new state to snapshots and exports
+        template <typename State>
+        void stateCreatedLocked(State& state, std::size_t type, ContextId context)
+        {
+            contexts_[context.value].states++;
+
+            using Storage = typename detail::storage_of<State>::type;
+            if constexpr (std::is_same_v<Storage, storage::Mapped>)
+                bindMapped(state, *contexts_[context.value].name);
+            else if constexpr (std::is_same_v<Storage, storage::Shared>)
+                bindShared(state, *contexts_[context.value].name);
+
+            if (type < snapshots_.size())
+                snapshots_[type].reset();
+
+            if constexpr (detail::exportable_state<State>::value)
+            {
+                if (type >= exporters_.size())
+                    exporters_.resize(type + 1, nullptr);
+                exporters_[type] = &ExportSection<State>;
+            }
+        }
+
+        template <typename State>
+        std::shared_ptr<State> getOrCreateStateLocked(ContextId context, detail::EvictionMarks** marks = nullptr)
+        {
+            const auto type = detail::StateTypeId<State>::value;
+
+            if constexpr (detail::evictable_state<State>::value)
+            {
+                using T     = typename detail::evictable_state<State>::type;
+                using Entry = typename detail::EvictionStore<T>::Entry;
+
+                auto& store = evictionStore<T>();
+                auto& slot  = slotLocked(type, context);
+                auto  entry = static_cast<Entry*>(slot.get());
+                if (entry)
+                {
+                    entry->referenced.store(true, std::memory_order_relaxed);
+                }
+                else
+                {
+                    // Make room first so the new state is never its own victim
+                    const auto now = std::chrono::steady_clock::now();
+                    evictOverflowLocked(store, 1, now);
+                    expireLocked(store, now, false);
+
+                    auto created      = std::allocate_shared<Entry>(poolAllocatorLocked<Entry>(type));
+                    created->context  = context.value;
+                    created->lastUsed = now;
+                    entry             = created.get();
+                    slot              = created;
+                    store.add(std::move(created));
+                    stateCreatedLocked(entry->state, type, context);
+                }
+
+                if (marks)
+                    *marks = entry;
+                return stateOf<State>(slot);
+            }
+            else
+            {
+                auto& slot = slotLocked(type, context);
+                if (!slot)
+                {
+                    auto state = std::allocate_shared<State>(poolAllocatorLocked<State>(type));
+                    slot       = state;
+                    stateCreatedLocked(*state, type, context);
+                }
+                return stateOf<State>(slot);
+            }
+        }
+
+        template <typename U>
+        detail::StatePoolAllocator<U> poolAllocatorLocked(std::size_t type)
+        {
+            if (type >= pools_.size())
+                pools_.resize(type + 1);
+            if (!pools_[type])
+                pools_[type] = std::make_shared<detail::StatePool>();
+            return detail::StatePoolAllocator<U>(pools_[type]);
+        }
+
+        template <typename T>
+        detail::EvictionStore<T>& evictionStore()
+        {
+            const auto type = detail::StateTypeId<LayerState<T>>::value;
+            if (type >= evictions_.size())
+                evictions_.resize(type + 1);
+            if (!evictions_[type])
+                evictions_[type] = std::make_unique<detail::EvictionStore<T>>();
+            return static_cast<detail::EvictionStore<T>&>(*evictions_[type]);
+        }
+
+        template <typename T>
+        void evictLocked(detail::EvictionStore<T>& store, std::size_t index, bool notify)
+        {
+            const auto type  = detail::StateTypeId<LayerState<T>>::value;
+            auto       entry = store.entries[index];
+            store.removeAt(index);
+
+            slots_[type][entry->context].reset();
+            entry->evicted.store(true, std::memory_order_release);
+            if (type < snapshots_.size())
+                snapshots_[type].reset();
+
+            if (notify && store.policy.onEvict)
+            {
+                pendingEvictions_.push_back([callback = store.policy.onEvict, entry, context = contexts_[entry->context].name]
+                    { callback(*context, entry->state.read()); });
+            }
+
+            // Handles see the evicted flag before the id can be handed to another context
+            contexts_[entry->context].states--;
+            releaseContextLocked(entry->context);
+        }
+
+        // Clock sweep: referenced states get a second chance, the first unreferenced one goes
+        template <typename T>
+        void evictOverflowLocked(detail::EvictionStore<T>& store, std::size_t incoming, std::chrono::steady_clock::time_point now)
+        {
+            const std::size_t limit = store.policy.maxStates;
+            while (limit != 0 && !store.entries.empty() && store.entries.size() + incoming > limit)
+            {
+                if (store.hand >= store.entries.size())
+                    store.hand = 0;
+
+                auto& entry = *store.entries[store.hand];
+                if (entry.referenced.exchange(false, std::memory_order_relaxed))
+                {
+                    entry.lastUsed = now;
+                    ++store.hand;
+                }
+                else
+                {
+                    evictLocked(store, store.hand, true);
+                }
+            }
+        }
+
+        template <typename T>
+        void expireLocked(detail::EvictionStore<T>& store, std::chrono::steady_clock::time_point now, bool force)
+        {
+            const auto ttl = store.policy.ttl;
+            if (ttl <= std::chrono::steady_clock::duration::zero() || (!force && now - store.lastExpiry < ttl / 4))
+                return;
 
-            // Count enabled layers
-            template<typename... Layers>
-            struct CountEnabledLayersImpl
+            store.lastExpiry = now;
+            for (std::size_t i = 0; i < store.entries.size();)
             {
-                static constexpr size_t value = (0 + ... + IsLayerEnabled<Layers>);
-            };
+                auto& entry = *store.entries[i];
+                if (entry.referenced.exchange(false, std::memory_order_relaxed))
+                {
+                    entry.lastUsed = now;
+                    ++i;
+                }
+                else if (now - entry.lastUsed >= ttl)
+                {
+                    evictLocked(store, i, true);
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
 
-            // Check if any layers are enabled
-            template<typename... Layers>
-            struct AnyLayersEnabledImpl
+        // Eviction callbacks are collected under the lock and run once it is released
+        template <typename State>
+        void runEvictions(std::unique_lock<std::mutex>& lock)
+        {
+            if constexpr (detail::evictable_state<State>::value)
             {
-                static constexpr bool value = (... || IsLayerEnabled<Layers>);
-            };
+                if (pendingEvictions_.empty())
+                    return;
 
+                auto pending = std::move(pendingEvictions_);
+                pendingEvictions_.clear();
+                lock.unlock();
+                for (const auto& callback : pending)
+                    callback();
+            }
         }
-    }
 
+    public:
+        std::mutex     mutex_;
+        std::once_flag init_flag_;
 
-    ////////////////////////////////////////
-    // Layer State Manager
-    ////////////////////////////////////////
+    private:
+        std::vector<std::vector<std::shared_ptr<void>>>                      slots_; // [StateTypeId][ContextId]
+        std::vector<std::shared_ptr<detail::StatePool>>                      pools_; // [StateTypeId], survive Clear()
+        std::vector<std::shared_ptr<const detail::StateSnapshot>>            snapshots_;
+        std::vector<void (*)(LayerStateRegistry&, const StateExportWriter&)> exporters_;
+        std::shared_ptr<MappedStateFile>                                     mappedFile_;
+        std::shared_ptr<SharedStateSegment>                                  sharedSegment_;
+        std::vector<std::unique_ptr<detail::EvictionStoreBase>>              evictions_;
+        std::vector<std::function<void()>>                                   pendingEvictions_;
+        std::atomic<std::uint64_t>                                           epoch_ { 1 };
+        std::vector<ContextEntry>                                            contexts_;
+        std::vector<std::uint32_t>                                           freeContexts_;
+        std::unordered_map<std::string, std::uint32_t>                       contextIds_;
+    };
 
     template <typename T>
-    class LayerState
+    class LayerStateWrapper
     {
     private:
-        mutable std::mutex                         mutex_;
-        T                                          data_;
-        std::vector<std::function<void(const T&)>> observers_;
+        std::shared_ptr<LayerState<T>> state_;
 
     public:
-        class Proxy
-        {
-        private:
-            LayerState<T>&               state_;
-            std::unique_lock<std::mutex> lock_;
+        explicit LayerStateWrapper(std::shared_ptr<LayerState<T>> state)
+            : state_(std::move(state)) {}
 
-        public:
-            Proxy(LayerState<T>& state)
-                : state_(state), lock_(state_.mutex_) {}
-            ~Proxy() { state_.notifyObservers(); }
+        auto operator->() { return state_->access(); }
+        auto operator->() const { return state_->access(); }
 
-            T*       operator->() { return &state_.data_; }
-            const T* operator->() const { return &state_.data_; }
-        };
+        T    read() const { return state_->read(); }
+        void write(const T& newData) { state_->write(newData); }
 
-        Proxy access() { return Proxy(*this); }
+        // Field updates for sync::Atomic states
+        template <auto Member, typename V>
+        auto fetch_add(V delta) { return state_->template fetch_add<Member>(delta); }
 
-        T read() const
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            return data_;
-        }
+        template <auto Member, typename V>
+        auto fetch_sub(V delta) { return state_->template fetch_sub<Member>(delta); }
 
-        void write(const T& newData)
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            data_ = newData;
-            notifyObservers();
-        }
+        template <auto Member>
+        auto load() const { return state_->template load<Member>(); }
 
         template <typename F>
         void modify(F&& func)
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            func(data_);
-            notifyObservers();
+            state_->modify(std::forward<F>(func));
         }
 
-        void addObserver(std::function<void(const T&)> observer)
+        ObserverSubscription addObserver(typename detail::ObserverList<T>::Callback observer)
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            observers_.push_back(std::move(observer));
+            return state_->addObserver(std::move(observer));
         }
+    };
 
+    /// @brief Cached reference to the state of one (T, context) pair
+    ///
+    /// Resolves through the registry once and then only re-resolves when the
+    /// registry epoch changes (Clear() or removeState()), so steady-state access
+    /// is an atomic load and a pointer dereference. A handle caches without
+    /// synchronization; keep one per thread (e.g. thread_local) or per owner.
+    template <typename T>
+    class LayerStateHandle
+    {
     private:
-        void notifyObservers()
+        static constexpr bool kEvictable = detail::evictable_state<LayerState<T>>::value;
+
+        ContextId                           context_;
+        mutable std::shared_ptr<const void> owner_;
+        mutable LayerState<T>*              state_ = nullptr;
+        mutable std::uint64_t               epoch_ = 0;
+        mutable detail::EvictionMarks*      marks_ = nullptr;
+
+        bool evicted() const
+        {
+            if constexpr (kEvictable)
+                return marks_->evicted.load(std::memory_order_acquire);
+            else
+                return false;
+        }
+
+        // Feeds the clock sweep, skips the store when the bit is already set
+        void touch() const
         {
-            for (const auto& observer : observers_)
+            if constexpr (kEvictable)
             {
-                observer(data_);
+                if (!marks_->referenced.load(std::memory_order_relaxed))
+                    marks_->referenced.store(true, std::memory_order_relaxed);
             }
         }
-    };
-
-    class LayerStateRegistry
-    {
-        template <typename T>
-        friend class LayerStateManager;
 
     public:
-        static void Clear() { GetInstance().clear(); }
-        static void setCurrentContext(const std::string& context) { currentContext = context; }
+        explicit LayerStateHandle(ContextId context = kGlobalContext)
+            : context_(context) {}
 
-        static const std::string& getCurrentContext() { return currentContext; }
+        explicit LayerStateHandle(const std::string& context)
+            : context_(LayerStateRegistry::InternContext(context)) {}
 
-    private:
-        static inline thread_local std::string currentContext;
-        static LayerStateRegistry&             GetInstance()
+        /// @brief The cached state, no refcount is taken on this path
+        LayerState<T>& get() const
         {
-            static LayerStateRegistry instance;
-            return instance;
+            auto& registry = LayerStateRegistry::GetInstance();
+            auto  epoch    = registry.epoch();
+            if (epoch != epoch_ || evicted())
+            {
+                state_ = registry.resolveState<T>(context_, owner_, &marks_);
+                epoch_ = epoch;
+            }
+            else
+            {
+                touch();
+            }
+            return *state_;
         }
 
-    public:
-        template <typename T>
-        std::shared_ptr<LayerState<T>> getOrCreateState(const std::string& key)
+        /// @brief Drops the cached state once Clear(), removeState() or eviction made it stale
+        ///
+        /// The next get() resolves again, so this only gives the memory back early.
+        void releaseIfStale()
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            auto&                       typeMap = states_[std::type_index(typeid(T))];
-            auto                        it      = typeMap.find(key);
-            if (it == typeMap.end())
+            if (state_ && (epoch_ != LayerStateRegistry::GetInstance().epoch() || evicted()))
             {
-                auto newState = std::make_shared<LayerState<T>>();
-                typeMap[key]  = newState;
-                return newState;
+                owner_.reset();
+                state_ = nullptr;
+                marks_ = nullptr;
+                epoch_ = 0;
             }
-            return std::static_pointer_cast<LayerState<T>>(it->second);
         }
 
-        void clear()
+        /// @brief Owning reference to the cached state, e.g. to build a LayerStateWrapper
+        std::shared_ptr<LayerState<T>> shared() const
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            states_.clear();
+            auto& state = get();
+            return std::shared_ptr<LayerState<T>>(owner_, &state);
         }
+        ContextId      context() const { return context_; }
 
-        void initialize()
+        auto operator->() const { return get().access(); }
+
+        T    read() const { return get().read(); }
+        void write(const T& newData) const { get().write(newData); }
+
+        // Field updates for sync::Atomic states
+        template <auto Member, typename V>
+        auto fetch_add(V delta) const { return get().template fetch_add<Member>(delta); }
+
+        template <auto Member, typename V>
+        auto fetch_sub(V delta) const { return get().template fetch_sub<Member>(delta); }
+
+        template <auto Member>
+        auto load() const { return get().template load<Member>(); }
+
+        template <typename F>
+        void modify(F&& func) const
         {
-            states_.reserve(10);
+            get().modify(std::forward<F>(func));
         }
 
-        template <typename T>
-        void removeState(std::string_view key)
+        ObserverSubscription addObserver(typename detail::ObserverList<T>::Callback observer) const
         {
-            std::unique_lock lock(mutex_);
-            auto             typeIt = states_.find(std::type_index(typeid(T)));
-            if (typeIt != states_.end())
-            {
-                typeIt->second.erase(std::string(key));
-            }
+            return get().addObserver(std::move(observer));
         }
+    };
 
-        template <typename T>
-        void iterateStates(const std::function<void(const std::string&, const LayerState<T>&)>& func)
+    /// @brief Makes a context current on the calling thread for a scope, then restores the previous one
+    ///
+    /// A context given by name is pinned for the scope instead of interned for
+    /// good, so per-request names do not accumulate in the registry.
+    class ScopedContext
+    {
+    private:
+        ContextId previous_;
+        ContextId context_;
+        bool      pinned_ = false;
+
+    public:
+        explicit ScopedContext(ContextId context)
+            : previous_(LayerStateRegistry::getCurrentContextId()), context_(context)
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            auto                        typeIt = states_.find(std::type_index(typeid(T)));
-            if (typeIt != states_.end())
-            {
-                for (const auto& [key, state] : typeIt->second)
-                {
-                    func(key, *std::static_pointer_cast<LayerState<T>>(state));
-                }
-            }
+            LayerStateRegistry::setCurrentContext(context);
         }
 
-        std::mutex mutex_;
-        std::unordered_map<std::type_index, std::unordered_map<std::string, std::shared_ptr<void>>>states_;
-        std::once_flag init_flag_;
+        explicit ScopedContext(const std::string& context)
+            : ScopedContext(LayerStateRegistry::PinContext(context))
+        {
+            pinned_ = true;
+        }
+
+        ~ScopedContext()
+        {
+            LayerStateRegistry::setCurrentContext(previous_);
+            if (pinned_)
+                LayerStateRegistry::UnpinContext(context_);
+        }
+
+        ScopedContext(const ScopedContext&)            = delete;
+        ScopedContext& operator=(const ScopedContext&) = delete;
     };
 
     template <typename T>
-    class LayerStateWrapper
+    class ShardedLayerStateWrapper
     {
     private:
-        std::shared_ptr<LayerState<T>> state_;
+        std::shared_ptr<ShardedLayerState<T>> state_;
 
     public:
-        explicit LayerStateWrapper(std::shared_ptr<LayerState<T>> state)
+        explicit ShardedLayerStateWrapper(std::shared_ptr<ShardedLayerState<T>> state)
             : state_(std::move(state)) {}
 
-        typename LayerState<T>::Proxy operator->() { return state_->access(); }
-        typename LayerState<T>::Proxy operator->() const { return state_->access(); }
+        typename ShardedLayerState<T>::Proxy operator->() { return state_->access(); }
+        typename ShardedLayerState<T>::Proxy operator->() const { return state_->access(); }
 
         T    read() const { return state_->read(); }
-        void write(const T& newData) { state_->write(newData); }
-
-        template <typename F>
-        void modify(F&& func)
-        {
-            state_->modify(std::forward<F>(func));
-        }
-
-        void addObserver(std::function<void(const T&)> observer)
-        {
-            state_->addObserver(std::move(observer));
-        }
+        T    aggregate() { return state_->aggregate(); }
+        void reset() { state_->reset(); }
     };
 
     template <typename T>
@@ -487,21 +5575,50 @@ namespace strata
     public:
         static LayerStateWrapper<T> global()
         {
-            return LayerStateWrapper<T>(LayerStateRegistry::GetInstance().getOrCreateState<T>("global"));
+            static thread_local LayerStateHandle<T> handle(kGlobalContext);
+            return LayerStateWrapper<T>(handle.shared());
         }
         static void setCurrentContext(const std::string& context)
         {
             LayerStateRegistry::setCurrentContext(context);
         }
 
+        static void setCurrentContext(ContextId context)
+        {
+            LayerStateRegistry::setCurrentContext(context);
+        }
+
         static const std::string& getCurrentContext()
         {
             return LayerStateRegistry::getCurrentContext();
         }
 
+        /// @brief State of the calling thread's current context
+        ///
+        /// Each thread keeps a flat table of cached handles indexed by ContextId, so a
+        /// lookup is an index and an epoch check instead of a string hash. Every
+        /// call also checks one other cached handle and releases its state if it
+        /// went stale, so cleared or evicted states are not held by idle entries.
         static LayerStateWrapper<T> current()
         {
-            return LayerStateWrapper<T>(LayerStateRegistry::GetInstance().getOrCreateState<T>(getCurrentContext()));
+            struct HandleTable
+            {
+                std::vector<LayerStateHandle<T>> handles;
+                std::size_t                      sweep = 0;
+            };
+            static thread_local HandleTable table;
+
+            auto&           handles = table.handles;
+            const ContextId context = LayerStateRegistry::getCurrentContextId();
+            while (handles.size() <= context.value)
+                handles.emplace_back(ContextId { static_cast<std::uint32_t>(handles.size()) });
+
+            if (++table.sweep >= handles.size())
+                table.sweep = 0;
+            if (table.sweep != context.value)
+                handles[table.sweep].releaseIfStale();
+
+            return LayerStateWrapper<T>(handles[context.value].shared());
         }
 
         static LayerStateWrapper<T> forContext(const std::string& context)
@@ -509,6 +5626,26 @@ namespace strata
             return LayerStateWrapper<T>(LayerStateRegistry::GetInstance().getOrCreateState<T>(context));
         }
 
+        static LayerStateWrapper<T> forContext(ContextId context)
+        {
+            return LayerStateWrapper<T>(LayerStateRegistry::GetInstance().getOrCreateState<T>(context));
+        }
+
+        /// @brief Cached handle for hot paths, see LayerStateHandle
+        static LayerStateHandle<T> handle(ContextId context = kGlobalContext) { return LayerStateHandle<T>(context); }
+        static LayerStateHandle<T> handle(const std::string& context) { return LayerStateHandle<T>(context); }
+
+        /// @brief Per-thread sharded counterpart of global(), see ShardedLayerState
+        static ShardedLayerStateWrapper<T> sharded()
+        {
+            return ShardedLayerStateWrapper<T>(LayerStateRegistry::GetInstance().getOrCreateState<T, ShardedLayerState<T>>("global"));
+        }
+
+        static ShardedLayerStateWrapper<T> sharded(const std::string& context)
+        {
+            return ShardedLayerStateWrapper<T>(LayerStateRegistry::GetInstance().getOrCreateState<T, ShardedLayerState<T>>(context));
+        }
+
         static void removeState(std::string_view context)
         {
             LayerStateRegistry::GetInstance().removeState<T>(context);
@@ -518,6 +5655,256 @@ namespace strata
         {
             LayerStateRegistry::GetInstance().iterateStates<T>(func);
         }
+
+        /// @brief Binary export of every context's T, see StateExportHeader
+        template <typename Writer>
+        static void exportStates(Writer&& writer)
+        {
+            LayerStateRegistry::GetInstance().exportStates<T>(std::forward<Writer>(writer));
+        }
+
+        static std::vector<std::byte> exportStates()
+        {
+            return LayerStateRegistry::GetInstance().exportStates<T>();
+        }
+
+        /// @brief Bounds the states of a lifetime::Evictable T, see StateEvictionPolicy
+        static void setEvictionPolicy(StateEvictionPolicy<T> policy)
+        {
+            LayerStateRegistry::GetInstance().setEvictionPolicy<T>(std::move(policy));
+        }
+
+        static void evictExpired()
+        {
+            LayerStateRegistry::GetInstance().evictExpired<T>();
+        }
     };
 
+
+    ////////////////////////////////////////
+    // Executors
+    ////////////////////////////////////////
+
+    namespace util
+    {
+        /// @brief Fixed-size thread pool with per-worker deques and work stealing
+        ///
+        /// ParallelFor splits a range into chunks spread over the worker deques. Workers take
+        /// from the back of their own deque and steal from the front of the others when idle.
+        /// The calling thread helps until its chunks are done, so nested use cannot deadlock.
+        class WorkStealingPool
+        {
+        private:
+            struct Task
+            {
+                void (*run)(void* job, std::size_t chunk);
+                void*       job;
+                std::size_t chunk;
+            };
+
+            struct alignas(strata::detail::kCacheLineSize) Queue
+            {
+                strata::detail::SpinLock lock;
+                std::deque<Task> tasks;
+            };
+
+            template <typename Body>
+            struct Job
+            {
+                Body*                    body;
+                std::size_t              count;
+                std::size_t              chunkSize;
+                std::atomic<std::size_t> remaining;
+                std::atomic<bool>        failed { false };
+                std::exception_ptr       error;
+
+                static void Run(void* self, std::size_t chunk)
+                {
+                    auto&             job   = *static_cast<Job*>(self);
+                    const std::size_t begin = chunk * job.chunkSize;
+                    try
+                    {
+                        if (!job.failed.load(std::memory_order_relaxed))
+                            (*job.body)(begin, std::min(begin + job.chunkSize, job.count));
+                    }
+                    catch (...)
+                    {
+                        if (!job.failed.exchange(true))
+                            job.error = std::current_exception();
+                    }
+                    job.remaining.fetch_sub(1, std::memory_order_acq_rel);
+                }
+            };
+
+            std::vector<std::unique_ptr<Queue>> queues_;
+            std::vector<std::thread>            workers_;
+            std::atomic<std::size_t>            queued_ { 0 };
+            std::atomic<std::size_t>            nextQueue_ { 0 };
+            std::atomic<bool>                   stopping_ { false };
+            std::mutex                          sleepMutex_;
+            std::condition_variable             wake_;
+
+        public:
+            /// @param threads Number of worker threads, the calling thread always helps as well
+            explicit WorkStealingPool(std::size_t threads = std::max(1u, std::thread::hardware_concurrency()) - 1)
+            {
+                for (std::size_t i = 0; i < std::max<std::size_t>(threads, 1); ++i)
+                    queues_.push_back(std::make_unique<Queue>());
+                for (std::size_t i = 0; i < threads; ++i)
+                    workers_.emplace_back([this, i] { workerLoop(i); });
+            }
+
+            ~WorkStealingPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(sleepMutex_);
+                    stopping_ = true;
+                }
+                wake_.notify_all();
+                for (auto& worker : workers_)
+                    worker.join();
+            }
+
+            WorkStealingPool(const WorkStealingPool&)            = delete;
+            WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+            /// @brief Process-wide pool sized to the hardware
+            static WorkStealingPool& Default()
+            {
+                static WorkStealingPool pool;
+                return pool;
+            }
+
+            /// @brief Threads that execute chunks, including the caller
+            std::size_t concurrency() const noexcept { return workers_.size() + 1; }
+
+            /// @brief Calls task(begin, end) over disjoint ranges covering [0, count)
+            ///
+            /// Returns when every range has run and rethrows the first exception; once a range
+            /// has thrown, ranges that have not started are skipped.
+            template <typename Body>
+            void ParallelFor(std::size_t count, Body&& body)
+            {
+                if (count == 0)
+                    return;
+
+                const std::size_t chunks = std::min(count, concurrency() * 4);
+                if (workers_.empty() || chunks == 1)
+                {
+                    body(std::size_t { 0 }, count);
+                    return;
+                }
+
+                using JobType = Job<std::remove_reference_t<Body>>;
+                JobType job;
+                job.body      = &body;
+                job.count     = count;
+                job.chunkSize = (count + chunks - 1) / chunks;
+                job.remaining = (count + job.chunkSize - 1) / job.chunkSize;
+
+                const std::size_t total = job.remaining.load(std::memory_order_relaxed);
+                const std::size_t first = nextQueue_.fetch_add(1, std::memory_order_relaxed);
+                for (std::size_t chunk = 0; chunk < total; ++chunk)
+                    push((first + chunk) % queues_.size(), Task { &JobType::Run, &job, chunk });
+
+                {
+                    std::lock_guard<std::mutex> lock(sleepMutex_);
+                }
+                wake_.notify_all();
+
+                // Help out instead of blocking, other jobs' chunks included
+                while (job.remaining.load(std::memory_order_acquire) > 0)
+                {
+                    if (auto task = take(first % queues_.size()))
+                        task->run(task->job, task->chunk);
+                    else
+                        std::this_thread::yield();
+                }
+
+                if (job.error)
+                    std::rethrow_exception(job.error);
+            }
+
+        private:
+            void push(std::size_t queue, Task task)
+            {
+                std::lock_guard<strata::detail::SpinLock> lock(queues_[queue]->lock);
+                queues_[queue]->tasks.push_back(task);
+                queued_.fetch_add(1, std::memory_order_release);
+            }
+
+            std::optional<Task> take(std::size_t home)
+            {
+                for (std::size_t offset = 0; offset < queues_.size(); ++offset)
+                {
+                    auto&                             queue = *queues_[(home + offset) % queues_.size()];
+                    std::lock_guard<strata::detail::SpinLock> lock(queue.lock);
+                    if (queue.tasks.empty())
+                        continue;
+
+                    Task task;
+                    if (offset == 0)
+                    {
+                        task = queue.tasks.back();
+                        queue.tasks.pop_back();
+                    }
+                    else
+                    {
+                        task = queue.tasks.front();
+                        queue.tasks.pop_front();
+                    }
+                    queued_.fetch_sub(1, std::memory_order_relaxed);
+                    return task;
+                }
+                return std::nullopt;
+            }
+
+            void workerLoop(std::size_t index)
+            {
+                while (true)
+                {
+                    if (auto task = take(index))
+                    {
+                        task->run(task->job, task->chunk);
+                        continue;
+                    }
+
+                    std::unique_lock<std::mutex> lock(sleepMutex_);
+                    wake_.wait(lock, [this] { return stopping_ || queued_.load(std::memory_order_acquire) > 0; });
+                    if (stopping_ && queued_.load(std::memory_order_acquire) == 0)
+                        return;
+                }
+            }
+        };
+
+        /// @brief Adapts a standard execution policy to the ParallelFor executor interface
+        ///
+        /// Requires `<execution>` to be included by the caller, e.g.
+        /// `util::PolicyExecutor executor(std::execution::par);`
+        template <typename Policy>
+        class PolicyExecutor
+        {
+        private:
+            Policy policy_;
+
+        public:
+            explicit PolicyExecutor(Policy policy) : policy_(policy) {}
+
+            template <typename Body>
+            void ParallelFor(std::size_t count, Body&& body)
+            {
+                if (count == 0)
+                    return;
+
+                const std::size_t        chunks    = std::min<std::size_t>(count, std::max(1u, std::thread::hardware_concurrency()) * 4u);
+                const std::size_t        chunkSize = (count + chunks - 1) / chunks;
+                std::vector<std::size_t> starts;
+                for (std::size_t begin = 0; begin < count; begin += chunkSize)
+                    starts.push_back(begin);
+
+                std::for_each(policy_, starts.begin(), starts.end(), [&](std::size_t begin) { body(begin, std::min(begin + chunkSize, count)); });
+            }
+        };
+    }
+
 }  // namespace strata